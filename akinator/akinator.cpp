@@ -412,7 +412,7 @@ static void akinator_destory_strings(akinator_tree tree) {
     if (tree == NULL)
         return;
 
-    free(tree->element);
+    safe_free(tree->element);
 
     if (tree->left  != NULL)
         akinator_destory_strings(tree->left);
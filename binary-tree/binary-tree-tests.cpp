@@ -25,7 +25,7 @@ TEST(search_in_binary_tree) {
            )
          );
 
-    simple_stack<path_node<int>> path;
+    binary_tree_path_t<int> path;
     simple_stack_create(&path);
 
     TEST_FINALIZER({
@@ -43,6 +43,54 @@ TEST(search_in_binary_tree) {
     CALL_TEST_FINALIZER();
 }
 
+TEST(search_path_deeper_than_inline_space) {
+    const int depth = 100; // Path won't fit in BINARY_TREE_PATH_INLINE_DEPTH
+
+    binary_tree<int>* tree = L(depth);
+    for (int i = depth - 1; i >= 0; -- i)
+        tree = N(i, tree, _);
+
+    binary_tree_path_t<int> path;
+    simple_stack_create(&path);
+
+    TEST_FINALIZER({
+        binary_tree_destroy(tree);
+        simple_stack_destruct(&path);
+    })
+
+    binary_tree_search(tree, depth, &path);
+    ASSERT_EQUAL((int) path.next_index, depth);
+
+    for (int i = 0; i < depth; ++ i)
+        ASSERT_EQUAL(*path.elements[i].node_value, i);
+
+    CALL_TEST_FINALIZER();
+}
+
+TEST(build_tree_from_pool) {
+    binary_tree_pool_t<int> pool = {};
+    TRY object_pool_create(&pool)
+        ASSERT_SUCCESS();
+
+    const int depth = 1000;
+
+    binary_tree<int>* tree = binary_tree_create_leaf(depth, &pool);
+    for (int i = depth - 1; i >= 0; -- i)
+        tree = binary_tree_create(i, tree, _, &pool);
+
+    ASSERT_EQUAL(binary_tree_search(tree, depth)->element, depth);
+
+    binary_tree_destroy(tree, &pool);
+
+    // Freed nodes are reused
+    binary_tree<int>* leaf = binary_tree_create_leaf(42, &pool);
+    ASSERT_EQUAL(leaf->element, 42);
+    ASSERT_EQUAL(binary_tree_is_leaf(leaf), true);
+
+    // Everything is released at once, without traversing the tree
+    object_pool_release(&pool);
+    object_pool_destroy(&pool);
+}
 
 int main(void) {
     return test_framework_run_all_unit_tests();
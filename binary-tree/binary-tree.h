@@ -1,6 +1,7 @@
 #pragma once
 
 #include <simple-stack.h>
+#include <safe-alloc.h>
 #include <stddef.h>
 #include <malloc.h>
 #include <stdio.h>
@@ -24,12 +25,26 @@ bool equivalence_function(const E* first, const E* second) {
     return *first == *second;
 }
 
+template <typename E>
+using binary_tree_pool_t = object_pool<binary_tree<E>>;
+
+/**
+ * Nodes are taken from pool, if it's given, otherwise they're allocated
+ * on heap. Tree should be destroyed with the same pool it was created with.
+ */
 template <typename E>
 binary_tree<E> *binary_tree_create(E node_value,
                                    binary_tree<E> *left  = NULL,
-                                   binary_tree<E> *right = NULL) {
+                                   binary_tree<E> *right = NULL,
+                                   binary_tree_pool_t<E>* pool = NULL) {
+
+  binary_tree<E> *tree = NULL;
+  if (pool != NULL)
+      TRY object_pool_alloc(pool, &tree)
+          THROW("Node allocation from pool failed!");
+  else
+      tree = (binary_tree<E>*) calloc(1, sizeof(*tree));
 
-  binary_tree<E> *tree = (binary_tree<E>*) calloc(1, sizeof(*tree));
   *tree = { .element = node_value,
             .left = left, .right = right };
 
@@ -37,22 +52,25 @@ binary_tree<E> *binary_tree_create(E node_value,
 }
 
 template <typename E>
-binary_tree<E>* binary_tree_create_leaf(E value) {
-    return binary_tree_create(value, EMPTY_NODE<E>, EMPTY_NODE<E>);
+binary_tree<E>* binary_tree_create_leaf(E value, binary_tree_pool_t<E>* pool = NULL) {
+    return binary_tree_create(value, EMPTY_NODE<E>, EMPTY_NODE<E>, pool);
 }
 
 template <typename E>
-void binary_tree_destroy(binary_tree<E>* subtree) {
+void binary_tree_destroy(binary_tree<E>* subtree, binary_tree_pool_t<E>* pool = NULL) {
     if (subtree == EMPTY_NODE<E>)
         return;
 
     if (subtree != EMPTY_NODE<E>)
-        binary_tree_destroy(subtree->left);
+        binary_tree_destroy(subtree->left, pool);
 
     if (subtree != EMPTY_NODE<E>)
-        binary_tree_destroy(subtree->right);
+        binary_tree_destroy(subtree->right, pool);
 
-    free(subtree);
+    if (pool != NULL)
+        object_pool_free(pool, subtree);
+    else
+        free(subtree);
 }
 
 enum path_choice { GO_LEFT, GO_RIGHT };
@@ -68,8 +86,11 @@ bool binary_tree_is_leaf(binary_tree<E>* tree) {
     return tree->left == EMPTY_NODE<E> && tree->right == EMPTY_NODE<E>;
 }
 
+// Paths are usually short, so they're kept on stack, until they aren't
+const size_t BINARY_TREE_PATH_INLINE_DEPTH = 32;
+
 template <typename E>
-using binary_tree_path_t = simple_stack<path_node<E>>;
+using binary_tree_path_t = simple_stack<path_node<E>, BINARY_TREE_PATH_INLINE_DEPTH>;
 
 template <typename E>
 binary_tree<E>* binary_tree_search(binary_tree<E>* tree, E value,
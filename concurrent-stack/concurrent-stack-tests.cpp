@@ -0,0 +1,103 @@
+#include "concurrent-stack.h"
+#include "test-framework.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+TEST(push_and_pop_in_single_thread) {
+    concurrent_stack<int> stack = {};
+    TRY concurrent_stack_create(&stack, 3)
+        ASSERT_SUCCESS();
+
+    for (int i = 0; i < 3; ++ i)
+        ASSERT_EQUAL(concurrent_stack_push(&stack, i), true);
+
+    // Pool is exhausted
+    ASSERT_EQUAL(concurrent_stack_push(&stack, 3), false);
+
+    int value = -1;
+    for (int i = 2; i >= 0; -- i) {
+        ASSERT_EQUAL(concurrent_stack_pop(&stack, &value), true);
+        ASSERT_EQUAL(value, i);
+    }
+
+    ASSERT_EQUAL(concurrent_stack_pop(&stack, &value), false);
+    ASSERT_EQUAL(concurrent_stack_empty(&stack), true);
+
+    concurrent_stack_destroy(&stack);
+}
+
+const int NUM_PRODUCERS = 8, NUM_CONSUMERS = 8;
+const int ITEMS_PER_PRODUCER = 20000;
+
+struct stack_worker {
+    concurrent_stack<long>* stack;
+
+    int id;
+    long sum; // Sum of popped elements for consumer
+    long count;
+};
+
+static void* produce(void* raw_worker) {
+    stack_worker* worker = (stack_worker*) raw_worker;
+
+    for (int i = 0; i < ITEMS_PER_PRODUCER; ++ i) {
+        const long value = (long) worker->id * ITEMS_PER_PRODUCER + i;
+
+        while (!concurrent_stack_push(worker->stack, value))
+            sched_yield(); // Wait for consumers to free some space
+    }
+
+    return NULL;
+}
+
+static void* consume(void* raw_worker) {
+    stack_worker* worker = (stack_worker*) raw_worker;
+
+    const long total = (long) NUM_PRODUCERS * ITEMS_PER_PRODUCER / NUM_CONSUMERS;
+
+    long value = 0;
+    while (worker->count < total) {
+        if (!concurrent_stack_pop(worker->stack, &value)) {
+            sched_yield(); // Wait for producers to push something
+            continue;
+        }
+
+        worker->sum += value;
+        ++ worker->count;
+    }
+
+    return NULL;
+}
+
+TEST(push_and_pop_from_many_threads) {
+    concurrent_stack<long> stack = {};
+
+    // Small pool, so nodes get reused all the time
+    TRY concurrent_stack_create(&stack, 64)
+        ASSERT_SUCCESS();
+
+    pthread_t threads[NUM_PRODUCERS + NUM_CONSUMERS];
+    stack_worker workers[NUM_PRODUCERS + NUM_CONSUMERS];
+
+    for (int i = 0; i < NUM_PRODUCERS + NUM_CONSUMERS; ++ i) {
+        workers[i] = { &stack, i, 0, 0 };
+        pthread_create(&threads[i], NULL, i < NUM_PRODUCERS ? produce : consume,
+                       &workers[i]);
+    }
+
+    long sum = 0;
+    for (int i = 0; i < NUM_PRODUCERS + NUM_CONSUMERS; ++ i) {
+        pthread_join(threads[i], NULL);
+        sum += workers[i].sum;
+    }
+
+    // Every element should be popped exactly once
+    const long total = (long) NUM_PRODUCERS * ITEMS_PER_PRODUCER;
+    ASSERT_EQUAL(sum == total * (total - 1) / 2, true);
+    ASSERT_EQUAL(concurrent_stack_empty(&stack), true);
+
+    concurrent_stack_destroy(&stack);
+}
+
+TEST_MAIN()
@@ -0,0 +1,179 @@
+#pragma once
+
+#include "trace.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <type_traits>
+
+/**
+ * Lock-free LIFO (Treiber stack) for any number of producers and consumers.
+ *
+ * Nodes come from a pool, that is allocated once on creation, so push and
+ * pop never call allocator, but stack can't grow past it's capacity. Nodes
+ * are referenced by indexes, top of the stack and top of free list are
+ * tagged with counter, that changes on every update, which protects
+ * compare-and-swap from ABA problem: node, that was popped and pushed
+ * back in between, won't be mistaken for unchanged top.
+ */
+
+typedef uint32_t concurrent_stack_index_t;
+
+const concurrent_stack_index_t CONCURRENT_STACK_NULL_INDEX = UINT32_MAX;
+
+template <typename E>
+struct concurrent_stack_node {
+    E element;
+    concurrent_stack_index_t next_index;
+};
+
+// Index in lower half, tag in upper one, so they're swapped together
+typedef uint64_t concurrent_stack_tagged_index_t;
+
+const size_t CONCURRENT_STACK_CACHE_LINE = 64;
+
+template <typename E>
+struct concurrent_stack {
+    static_assert(std::is_trivially_copyable_v<E>,
+                  "Elements are copied in and out of the pool bytewise!");
+
+    concurrent_stack_node<E>* nodes;
+    size_t capacity;
+
+    // Separate cache lines, so producers and consumers don't
+    // invalidate each other's caches more than they have to
+    alignas(CONCURRENT_STACK_CACHE_LINE) concurrent_stack_tagged_index_t top;
+    alignas(CONCURRENT_STACK_CACHE_LINE) concurrent_stack_tagged_index_t free;
+};
+
+
+inline concurrent_stack_index_t
+__concurrent_stack_get_index(concurrent_stack_tagged_index_t tagged) {
+    return (concurrent_stack_index_t) (tagged & UINT32_MAX);
+}
+
+inline concurrent_stack_tagged_index_t
+__concurrent_stack_retag(concurrent_stack_tagged_index_t old_tagged,
+                         concurrent_stack_index_t new_index) {
+    const uint64_t new_tag = (old_tagged >> 32) + 1;
+    return new_tag << 32 | new_index;
+}
+
+template <typename E>
+static inline concurrent_stack_index_t
+__concurrent_stack_take(concurrent_stack<E>* stack, concurrent_stack_tagged_index_t* list) {
+    concurrent_stack_tagged_index_t current =
+        __atomic_load_n(list, __ATOMIC_ACQUIRE);
+
+    while (true) {
+        const concurrent_stack_index_t index = __concurrent_stack_get_index(current);
+        if (index == CONCURRENT_STACK_NULL_INDEX)
+            return CONCURRENT_STACK_NULL_INDEX;
+
+        // Node could've been taken and changed by now, then tag
+        // has changed as well, and compare-and-swap will fail
+        const concurrent_stack_index_t next_index =
+            __atomic_load_n(&stack->nodes[index].next_index, __ATOMIC_RELAXED);
+
+        if (__atomic_compare_exchange_n(list, &current,
+                __concurrent_stack_retag(current, next_index), true,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return index; // Node is ours now
+    }
+}
+
+template <typename E>
+static inline void
+__concurrent_stack_put(concurrent_stack<E>* stack, concurrent_stack_tagged_index_t* list,
+                       concurrent_stack_index_t index) {
+    concurrent_stack_tagged_index_t current =
+        __atomic_load_n(list, __ATOMIC_RELAXED);
+
+    do {
+        __atomic_store_n(&stack->nodes[index].next_index,
+                         __concurrent_stack_get_index(current), __ATOMIC_RELAXED);
+
+    } while (!__atomic_compare_exchange_n(list, &current,
+                __concurrent_stack_retag(current, index), true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+
+template <typename E>
+stack_trace* concurrent_stack_create(concurrent_stack<E>* stack, const size_t capacity) {
+    if (capacity == 0 || capacity >= CONCURRENT_STACK_NULL_INDEX)
+        return FAILURE(RUNTIME_ERROR, "Capacity %zu is out of range [1, %u)!",
+                       capacity, CONCURRENT_STACK_NULL_INDEX);
+
+    stack->nodes = (concurrent_stack_node<E>*) calloc(capacity, sizeof(*stack->nodes));
+    if (stack->nodes == NULL)
+        return FAILURE(RUNTIME_ERROR, strerror(errno));
+
+    stack->capacity = capacity;
+
+    // Initially every node is free and chained in order
+    for (size_t i = 0; i < capacity; ++ i)
+        stack->nodes[i].next_index = i + 1 == capacity ?
+            CONCURRENT_STACK_NULL_INDEX : (concurrent_stack_index_t) (i + 1);
+
+    stack->top  = CONCURRENT_STACK_NULL_INDEX;
+    stack->free = 0;
+
+    return SUCCESS();
+}
+
+/**
+ * Should be called only when no other thread uses stack.
+ */
+template <typename E>
+void concurrent_stack_destroy(concurrent_stack<E>* stack) {
+    if (stack != NULL) {
+        free(stack->nodes), stack->nodes = NULL;
+        stack->capacity = 0;
+    }
+
+    // Do nothing if stack is NULL (like free)
+}
+
+/**
+ * @return false if there's no free nodes left in the pool
+ */
+template <typename E>
+bool concurrent_stack_push(concurrent_stack<E>* stack, const E value) {
+    const concurrent_stack_index_t index = __concurrent_stack_take(stack, &stack->free);
+
+    if (index == CONCURRENT_STACK_NULL_INDEX)
+        return false;
+
+    stack->nodes[index].element = value; // Nobody else can see this node yet
+    __concurrent_stack_put(stack, &stack->top, index);
+
+    return true;
+}
+
+/**
+ * @return false if stack is empty
+ */
+template <typename E>
+bool concurrent_stack_pop(concurrent_stack<E>* stack, E* const value) {
+    const concurrent_stack_index_t index = __concurrent_stack_take(stack, &stack->top);
+
+    if (index == CONCURRENT_STACK_NULL_INDEX)
+        return false;
+
+    *value = stack->nodes[index].element;
+    __concurrent_stack_put(stack, &stack->free, index);
+
+    return true;
+}
+
+/**
+ * Result can be outdated by the time it's returned, if stack is shared.
+ */
+template <typename E>
+bool concurrent_stack_empty(concurrent_stack<E>* stack) {
+    return __concurrent_stack_get_index(__atomic_load_n(&stack->top, __ATOMIC_ACQUIRE))
+        == CONCURRENT_STACK_NULL_INDEX;
+}
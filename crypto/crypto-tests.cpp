@@ -0,0 +1,335 @@
+#include "crypto.h"
+#include "fast-hash.h"
+#include "sha256-backends.h"
+#include "tree-hash.h"
+#include "test-framework.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+TEST(crc32c_matches_reference) {
+    ASSERT_EQUAL(hash_with_crc32c("123456789", 9) == 0xE3069283u, true);
+
+    // Vectors from RFC 3720 (iSCSI), word loop and byte tail both run
+    unsigned char data[32] = {};
+    ASSERT_EQUAL(hash_with_crc32c(data, sizeof(data)) == 0x8A9136AAu, true);
+
+    memset(data, 0xFF, sizeof(data));
+    ASSERT_EQUAL(hash_with_crc32c(data, sizeof(data)) == 0x62A8AB43u, true);
+
+    for (size_t i = 0; i < sizeof(data); ++ i)
+        data[i] = (unsigned char) i;
+
+    ASSERT_EQUAL(hash_with_crc32c(data, sizeof(data)) == 0x46DD794Eu, true);
+}
+
+TEST(crc32c_continues_from_seed) {
+    const char* message = "123456789";
+
+    // Previous CRC is a seed for the rest of the data
+    const uint32_t first_part = hash_with_crc32c(message, 4);
+    ASSERT_EQUAL(hash_with_crc32c(message + 4, 5, first_part) == 0xE3069283u, true);
+}
+
+static bool xxh64_equal(const char* message, const uint64_t seed, const uint64_t expected) {
+    return hash_with_xxh64(message, strlen(message), seed) == expected;
+}
+
+TEST(xxh64_matches_reference) {
+    ASSERT_EQUAL(xxh64_equal("",    0, 0xEF46DB3751D8E999ULL), true);
+    ASSERT_EQUAL(xxh64_equal("a",   0, 0xD24EC4F1A98C6E5BULL), true);
+    ASSERT_EQUAL(xxh64_equal("abc", 0, 0x44BC2CF5AD770999ULL), true);
+
+    ASSERT_EQUAL(xxh64_equal("xxhash", 0,        0x32DD38952C4BC720ULL), true);
+    ASSERT_EQUAL(xxh64_equal("xxhash", 20141025, 0xB559B98D844E0635ULL), true);
+
+    // Long enough for four lanes
+    ASSERT_EQUAL(xxh64_equal("Nobody inspects the spammish repetition", 0,
+                             0xFBCEA83C8A378BF1ULL), true);
+}
+
+static bool sha256_equal(const void* data, const size_t size, const uint32_t (&expected)[HASH_SIZE]) {
+    uint32_t hash[HASH_SIZE] = {};
+    hash_with_sha_256(data, size, hash);
+
+    return memcmp(hash, expected, sizeof(hash)) == 0;
+}
+
+TEST(sha256_matches_fips_180_2) {
+    const uint32_t abc[HASH_SIZE] = {
+        0xba7816bf, 0x8f01cfea, 0x414140de, 0x5dae2223,
+        0xb00361a3, 0x96177a9c, 0xb410ff61, 0xf20015ad
+    };
+
+    ASSERT_EQUAL(sha256_equal("abc", 3, abc), true);
+
+    const uint32_t empty[HASH_SIZE] = {
+        0xe3b0c442, 0x98fc1c14, 0x9afbf4c8, 0x996fb924,
+        0x27ae41e4, 0x649b934c, 0xa495991b, 0x7852b855
+    };
+
+    ASSERT_EQUAL(sha256_equal("", 0, empty), true);
+
+    // Size doesn't fit after the padding, so it takes an extra block
+    const char* two_blocks = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+    const uint32_t two_blocks_hash[HASH_SIZE] = {
+        0x248d6a61, 0xd20638b8, 0xe5c02693, 0x0c3e6039,
+        0xa33ce459, 0x64ff2167, 0xf6ecedd4, 0x19db06c1
+    };
+
+    ASSERT_EQUAL(sha256_equal(two_blocks, strlen(two_blocks), two_blocks_hash), true);
+
+    const size_t million = 1000000;
+    char* as = (char*) malloc(million);
+    memset(as, 'a', million);
+
+    const uint32_t million_as[HASH_SIZE] = {
+        0xcdc76e5c, 0x9914fb92, 0x81a1c7e2, 0x84d73e67,
+        0xf1809a48, 0xa497200e, 0x046d39cc, 0xc7112cd0
+    };
+
+    ASSERT_EQUAL(sha256_equal(as, million, million_as), true);
+    free(as);
+}
+
+TEST(sha256_update_in_chunks_matches_one_shot) {
+    unsigned char data[1000] = {};
+    for (size_t i = 0; i < sizeof(data); ++ i)
+        data[i] = (unsigned char) (i * 131 + 7);
+
+    uint32_t random = 1;
+
+    for (size_t size = 0; size <= sizeof(data); ++ size) {
+        uint32_t expected[HASH_SIZE] = {};
+        hash_with_sha_256(data, size, expected);
+
+        sha256_context context = {};
+        sha256_init(&context);
+
+        // Chunks of random sizes, empty and longer than a block included
+        for (size_t fed = 0; fed < size; ) {
+            random = random * 1103515245 + 12345;
+
+            const size_t chunk = (random >> 16) % (2 * SHA_256_BLOCK_SIZE + 1);
+            const size_t taken = chunk < size - fed ? chunk : size - fed;
+
+            sha256_update(&context, data + fed, taken);
+            fed += taken;
+        }
+
+        uint32_t hash[HASH_SIZE] = {};
+        sha256_final(&context, hash);
+
+        ASSERT_EQUAL(memcmp(hash, expected, sizeof(hash)), 0);
+    }
+}
+
+TEST(sha256_backends_agree) {
+    if (!__sha256_has_sha_extensions())
+        return; // Nothing to compare scalar code with
+
+    unsigned char blocks[16 * SHA_256_BLOCK_SIZE] = {};
+    for (size_t i = 0; i < sizeof(blocks); ++ i)
+        blocks[i] = (unsigned char) (i * 151 + 3);
+
+    for (size_t count = 0; count <= 16; ++ count) {
+        uint32_t scalar[HASH_SIZE] = {}, sha_ni[HASH_SIZE] = {};
+
+        // Arbitrary starting state, not only H0
+        for (size_t i = 0; i < HASH_SIZE; ++ i)
+            scalar[i] = sha_ni[i] = (uint32_t) (count * 0x9E3779B9u + i);
+
+        __sha256_process_blocks_scalar(blocks, count, scalar);
+        __sha256_process_blocks_sha_ni(blocks, count, sha_ni);
+
+        ASSERT_EQUAL(memcmp(scalar, sha_ni, sizeof(scalar)), 0);
+    }
+}
+
+typedef void (*hash_many_fn_t)(const void* const inputs[], const size_t sizes[],
+                               const size_t count, uint32_t outputs[][HASH_SIZE]);
+
+// Every size up to several blocks, count isn't a multiple of lanes
+static bool hash_many_matches_one_shot(hash_many_fn_t hash_many) {
+    const size_t count = 300;
+
+    unsigned char data[count] = {};
+    for (size_t i = 0; i < count; ++ i)
+        data[i] = (unsigned char) (i * 37 + 11);
+
+    const void* inputs[count] = {};
+    size_t sizes[count] = {};
+
+    for (size_t i = 0; i < count; ++ i)
+        inputs[i] = data + i % 7, sizes[i] = (i * 97) % (count - 6);
+
+    uint32_t (*outputs)[HASH_SIZE] = (uint32_t (*)[HASH_SIZE]) calloc(count, sizeof(*outputs));
+    hash_many(inputs, sizes, count, outputs);
+
+    bool matches = true;
+    for (size_t i = 0; i < count; ++ i) {
+        uint32_t expected[HASH_SIZE] = {};
+        hash_with_sha_256(inputs[i], sizes[i], expected);
+
+        matches = matches && memcmp(outputs[i], expected, sizeof(expected)) == 0;
+    }
+
+    free(outputs);
+    return matches;
+}
+
+TEST(sha256_hash_many_backends_match_one_shot) {
+    ASSERT_EQUAL(hash_many_matches_one_shot(__sha256_hash_many_one_by_one), true);
+    ASSERT_EQUAL(hash_many_matches_one_shot(hash_with_sha_256_many), true);
+
+    if (__builtin_cpu_supports("avx2"))
+        ASSERT_EQUAL(hash_many_matches_one_shot(__sha256_hash_many_avx2), true);
+
+    if (__builtin_cpu_supports("avx512f"))
+        ASSERT_EQUAL(hash_many_matches_one_shot(__sha256_hash_many_avx512), true);
+}
+
+// Straight from the definition in tree-hash.h, one level at a time
+static void reference_tree_root(const unsigned char* data, const size_t size,
+                                const size_t leaf_size, uint32_t root[HASH_SIZE]) {
+
+    size_t level_size = size == 0 ? 1 : (size + leaf_size - 1) / leaf_size;
+    uint32_t (*level)[HASH_SIZE] = (uint32_t (*)[HASH_SIZE]) calloc(level_size, sizeof(*level));
+
+    for (size_t leaf = 0; leaf < level_size; ++ leaf) {
+        const size_t start = leaf * leaf_size;
+
+        unsigned char prefixed[1 + 64] = { 0x00 };
+        const size_t leaf_bytes = size - start < leaf_size ? size - start : leaf_size;
+        memcpy(prefixed + 1, data + start, leaf_bytes);
+
+        hash_with_sha_256(prefixed, 1 + leaf_bytes, level[leaf]);
+    }
+
+    for (; level_size > 1; level_size = (level_size + 1) / 2) {
+        for (size_t i = 0; i < level_size; i += 2) {
+            if (i + 1 == level_size) {
+                memcpy(level[i / 2], level[i], sizeof(*level));
+                break;
+            }
+
+            unsigned char children[1 + 2 * HASH_SIZE * sizeof(uint32_t)] = { 0x01 };
+            for (size_t word = 0; word < 2 * HASH_SIZE; ++ word)
+                for (size_t byte = 0; byte < sizeof(uint32_t); ++ byte)
+                    children[1 + word * sizeof(uint32_t) + byte] = (unsigned char)
+                        (level[i + word / HASH_SIZE][word % HASH_SIZE] >> (24 - 8 * byte));
+
+            hash_with_sha_256(children, sizeof(children), level[i / 2]);
+        }
+    }
+
+    memcpy(root, level[0], sizeof(*level));
+    free(level);
+}
+
+TEST(tree_hash_matches_definition_for_any_leaf_count) {
+    unsigned char data[7 * 64] = {};
+    for (size_t i = 0; i < sizeof(data); ++ i)
+        data[i] = (unsigned char) (i * 53 + 1);
+
+    // Sizes give every leaf count up to seven, last leaf full or not
+    const size_t leaf_size = 64;
+    for (size_t size = 0; size <= sizeof(data); size += 13) {
+        uint32_t expected[HASH_SIZE] = {};
+        reference_tree_root(data, size, leaf_size, expected);
+
+        for (unsigned threads = 1; threads <= 3; ++ threads) {
+            tree_hash tree = {};
+            ASSERT_EQUAL(tree_hash_create(&tree, data, size, leaf_size, threads), true);
+
+            uint32_t root[HASH_SIZE] = {};
+            tree_hash_root(&tree, root);
+
+            ASSERT_EQUAL(memcmp(root, expected, sizeof(root)), 0);
+            tree_hash_destroy(&tree);
+        }
+    }
+}
+
+TEST(tree_hash_rejects_empty_leaves) {
+    tree_hash tree = {};
+    ASSERT_EQUAL(tree_hash_create(&tree, "abc", 3, 0), false);
+
+    // Failed tree can still be destroyed
+    tree_hash_destroy(&tree);
+}
+
+TEST(tree_hash_verifies_ranges_and_catches_bit_flips) {
+    const size_t leaf_size = 16, size = 5 * leaf_size + 3; // Six leaves, short last one
+
+    unsigned char data[size] = {};
+    for (size_t i = 0; i < size; ++ i)
+        data[i] = (unsigned char) (i * 29 + 5);
+
+    tree_hash tree = {};
+    ASSERT_EQUAL(tree_hash_create(&tree, data, size, leaf_size, 2), true);
+
+    uint32_t root[HASH_SIZE] = {};
+    tree_hash_root(&tree, root);
+
+    for (size_t offset = 0; offset <= size; ++ offset)
+        for (size_t length = 0; offset + length <= size; ++ length)
+            ASSERT_EQUAL(tree_hash_verify_range(&tree, root, data, offset, length), true);
+
+    ASSERT_EQUAL(tree_hash_verify_range(&tree, root, data, size - 1, 2), false);
+
+    const size_t flipped = 2 * leaf_size + 5;
+    data[flipped] ^= 0x10;
+
+    // Only ranges, that touch the flipped leaf, notice it
+    for (size_t offset = 0; offset < size; ++ offset)
+        for (size_t length = 1; offset + length <= size; ++ length) {
+            const bool touches_leaf = offset / leaf_size <= flipped / leaf_size &&
+                                      (offset + length - 1) / leaf_size >= flipped / leaf_size;
+
+            ASSERT_EQUAL(tree_hash_verify_range(&tree, root, data, offset, length), !touches_leaf);
+        }
+
+    tree_hash_destroy(&tree);
+}
+
+// Long message among short ones is hashed apart from them
+static bool long_lane_matches_one_shot(hash_many_fn_t hash_many) {
+    const size_t count = 41, long_size = 64 * 1024;
+
+    unsigned char* data = (unsigned char*) malloc(long_size);
+    for (size_t i = 0; i < long_size; ++ i)
+        data[i] = (unsigned char) (i * 59 + 17);
+
+    const void* inputs[count] = {};
+    size_t sizes[count] = {};
+
+    for (size_t i = 0; i < count; ++ i)
+        inputs[i] = data + i, sizes[i] = i == count / 2 ? long_size - i : i;
+
+    uint32_t outputs[count][HASH_SIZE] = {};
+    hash_many(inputs, sizes, count, outputs);
+
+    bool matches = true;
+    for (size_t i = 0; i < count; ++ i) {
+        uint32_t expected[HASH_SIZE] = {};
+        hash_with_sha_256(inputs[i], sizes[i], expected);
+
+        matches = matches && memcmp(outputs[i], expected, sizeof(expected)) == 0;
+    }
+
+    free(data);
+    return matches;
+}
+
+TEST(sha256_hash_many_backends_split_off_long_lanes) {
+    if (__builtin_cpu_supports("avx2"))
+        ASSERT_EQUAL(long_lane_matches_one_shot(__sha256_hash_many_avx2), true);
+
+    if (__builtin_cpu_supports("avx512f"))
+        ASSERT_EQUAL(long_lane_matches_one_shot(__sha256_hash_many_avx512), true);
+}
+
+int main(void) {
+    return test_framework_run_all_unit_tests();
+}
@@ -6,8 +6,39 @@
 
 const size_t HASH_SIZE = 8;
 
+const size_t SHA_256_BLOCK_SIZE = 64;
+
 void hash_with_sha_256(const void* const data_ptr,
                        const size_t size,
                        uint32_t output_hash[HASH_SIZE]);
 
+/**
+ * Hash count independent messages, outputs[i] is the same as
+ * #hash_with_sha_256 of inputs[i]. Short messages are hashed
+ * several at once in SIMD lanes, if processor supports it.
+ */
+void hash_with_sha_256_many(const void* const inputs[], const size_t sizes[],
+                            const size_t count, uint32_t outputs[][HASH_SIZE]);
+
+/**
+ * State of SHA-256 computation, that data is fed to chunk by chunk,
+ * so it never needs to be in memory all at once. Result is the same
+ * as #hash_with_sha_256 of all chunks concatenated.
+ */
+struct sha256_context {
+    uint32_t state[HASH_SIZE];
+
+    unsigned char buffer[SHA_256_BLOCK_SIZE]; //!< Incomplete block, waiting for more data
+    size_t buffered_size;
+
+    uint64_t total_size; //!< In bytes
+};
+
+void sha256_init(sha256_context* const context);
+
+void sha256_update(sha256_context* const context,
+                   const void* const data_ptr, const size_t size);
+
+void sha256_final(sha256_context* const context, uint32_t output_hash[HASH_SIZE]);
+
 #endif
@@ -0,0 +1,163 @@
+#include "fast-hash.h"
+
+#include <string.h>
+#include <nmmintrin.h>
+
+// ---------------------------- CRC32C ----------------------------
+
+// Reversed Castagnoli polynomial
+static const uint32_t CRC32C_POLYNOMIAL = 0x82F63B78;
+
+struct crc32c_table {
+    uint32_t entries[256];
+};
+
+// Generated at compile time, so it's ready even for static initializers
+static constexpr crc32c_table generate_crc32c_table(void) {
+    crc32c_table table = {};
+
+    for (uint32_t byte = 0; byte < 256; ++ byte) {
+        uint32_t crc = byte;
+
+        for (int bit = 0; bit < 8; ++ bit)
+            crc = (crc >> 1) ^ (crc & 1 ? CRC32C_POLYNOMIAL : 0);
+
+        table.entries[byte] = crc;
+    }
+
+    return table;
+}
+
+static constexpr crc32c_table CRC32C_TABLE = generate_crc32c_table();
+
+static uint32_t crc32c_software(const unsigned char* data, size_t size, uint32_t crc) {
+    for (size_t i = 0; i < size; ++ i)
+        crc = CRC32C_TABLE.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+}
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(const unsigned char* data, size_t size, uint32_t crc) {
+    uint64_t crc64 = crc;
+
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), data += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, data, sizeof(word)); // Data can be unaligned
+
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+
+    crc = (uint32_t) crc64;
+    for (; size > 0; -- size, ++ data)
+        crc = _mm_crc32_u8(crc, *data);
+
+    return crc;
+}
+
+typedef uint32_t (*crc32c_fn_t)(const unsigned char* data, size_t size, uint32_t crc);
+
+static uint32_t crc32c_resolve(const unsigned char* data, size_t size, uint32_t crc);
+
+// Constant initialized, so it works even for callers from other static initializers
+static crc32c_fn_t crc32c = crc32c_resolve;
+
+// Check processor only once, on the first call
+static uint32_t crc32c_resolve(const unsigned char* data, size_t size, uint32_t crc) {
+    __builtin_cpu_init(); // Could be called before constructors
+
+    const crc32c_fn_t chosen = __builtin_cpu_supports("sse4.2") ?
+                               crc32c_hardware : crc32c_software;
+
+    __atomic_store_n(&crc32c, chosen, __ATOMIC_RELAXED);
+    return chosen(data, size, crc);
+}
+
+uint32_t hash_with_crc32c(const void* const data_ptr, const size_t size,
+                          const uint32_t seed) {
+    const unsigned char* data = (const unsigned char*) data_ptr;
+
+    // CRC is inverted before and after, as specification requires
+    return ~__atomic_load_n(&crc32c, __ATOMIC_RELAXED)(data, size, ~seed);
+}
+
+// ----------------------------- XXH64 ----------------------------
+
+// Primes mandated by the xxHash specification
+static const uint64_t XXH64_PRIME_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t XXH64_PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t XXH64_PRIME_3 = 0x165667B19E3779F9ULL;
+static const uint64_t XXH64_PRIME_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t XXH64_PRIME_5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl64(const uint64_t value, const int count) {
+    return value << count | value >> (64 - count);
+}
+
+// Words are little endian, regardless of the machine, on x86 it's just a load
+static inline uint32_t read32(const unsigned char* data) {
+    return (uint32_t) data[0]       | (uint32_t) data[1] <<  8 |
+           (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24;
+}
+
+static inline uint64_t read64(const unsigned char* data) {
+    return (uint64_t) read32(data) | (uint64_t) read32(data + sizeof(uint32_t)) << 32;
+}
+
+static inline uint64_t xxh64_round(uint64_t accumulator, const uint64_t input) {
+    accumulator += input * XXH64_PRIME_2;
+    accumulator  = rotl64(accumulator, 31);
+    return accumulator * XXH64_PRIME_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t accumulator, const uint64_t value) {
+    accumulator ^= xxh64_round(0, value);
+    return accumulator * XXH64_PRIME_1 + XXH64_PRIME_4;
+}
+
+uint64_t hash_with_xxh64(const void* const data_ptr, const size_t size,
+                         const uint64_t seed) {
+    const unsigned char* data = (const unsigned char*) data_ptr;
+    const unsigned char* const end = data + size;
+
+    uint64_t hash = 0;
+
+    if (size >= 32) {
+        // Four independent lanes, so processor can run them in parallel
+        uint64_t lanes[4] = {
+            seed + XXH64_PRIME_1 + XXH64_PRIME_2,
+            seed + XXH64_PRIME_2, seed, seed - XXH64_PRIME_1
+        };
+
+        for (; end - data >= 32; data += 32)
+            for (size_t i = 0; i < 4; ++ i)
+                lanes[i] = xxh64_round(lanes[i], read64(data + i * sizeof(uint64_t)));
+
+        hash = rotl64(lanes[0], 1) + rotl64(lanes[1],  7) +
+               rotl64(lanes[2], 12) + rotl64(lanes[3], 18);
+
+        for (int i = 0; i < 4; ++ i)
+            hash = xxh64_merge_round(hash, lanes[i]);
+    } else
+        hash = seed + XXH64_PRIME_5;
+
+    hash += (uint64_t) size;
+
+    for (; end - data >= 8; data += 8)
+        hash = rotl64(hash ^ xxh64_round(0, read64(data)), 27) * XXH64_PRIME_1 + XXH64_PRIME_4;
+
+    if (end - data >= 4) {
+        hash = rotl64(hash ^ read32(data) * XXH64_PRIME_1, 23) * XXH64_PRIME_2 + XXH64_PRIME_3;
+        data += 4;
+    }
+
+    for (; data < end; ++ data)
+        hash = rotl64(hash ^ *data * XXH64_PRIME_5, 11) * XXH64_PRIME_1;
+
+    // Final avalanche, so every input bit affects every output bit
+    hash ^= hash >> 33; hash *= XXH64_PRIME_2;
+    hash ^= hash >> 29; hash *= XXH64_PRIME_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Non-cryptographic hashes, that are good at detecting accidental
+ * corruption, but are worthless against someone doing it on purpose.
+ * They're many times faster than #hash_with_sha_256.
+ */
+
+/**
+ * CRC-32C (Castagnoli), uses SSE4.2 crc32 instruction if
+ * processor supports it and table lookup otherwise.
+ */
+uint32_t hash_with_crc32c(const void* const data_ptr, const size_t size,
+                          const uint32_t seed = 0);
+
+/**
+ * 64-bit xxHash (XXH64).
+ */
+uint64_t hash_with_xxh64(const void* const data_ptr, const size_t size,
+                         const uint64_t seed = 0);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "crypto.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Implementations, that SHA-256 chooses from depending on processor.
+ * They aren't part of the interface, only exposed so tests can compare
+ * them directly, whatever the machine running tests prefers.
+ */
+
+/**
+ * Compress number_of_blocks consecutive blocks into state.
+ */
+void __sha256_process_blocks_scalar(const unsigned char* blocks, size_t number_of_blocks,
+                                    uint32_t state[HASH_SIZE]);
+
+/**
+ * Same as #__sha256_process_blocks_scalar, but with Intel SHA extensions,
+ * call it only if #__sha256_has_sha_extensions.
+ */
+void __sha256_process_blocks_sha_ni(const unsigned char* blocks, size_t number_of_blocks,
+                                    uint32_t state[HASH_SIZE]);
+
+bool __sha256_has_sha_extensions(void);
+
+/**
+ * Multi-buffer hashing with eight AVX2 lanes, call it only if
+ * processor supports AVX2. Same result as #hash_with_sha_256_many.
+ */
+void __sha256_hash_many_avx2(const void* const inputs[], const size_t sizes[],
+                             const size_t count, uint32_t outputs[][HASH_SIZE]);
+
+/**
+ * Same with sixteen AVX-512 lanes, call it only if processor supports AVX-512F.
+ */
+void __sha256_hash_many_avx512(const void* const inputs[], const size_t sizes[],
+                               const size_t count, uint32_t outputs[][HASH_SIZE]);
+
+/**
+ * Fallback, that hashes messages one after another.
+ */
+void __sha256_hash_many_one_by_one(const void* const inputs[], const size_t sizes[],
+                                   const size_t count, uint32_t outputs[][HASH_SIZE]);
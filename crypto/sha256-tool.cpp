@@ -0,0 +1,407 @@
+#include "crypto.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Files are hashed in one go, if they can be mapped, otherwise in chunks
+static const size_t READ_CHUNK_SIZE = 1 << 20;
+
+// Length of hash printed in hex
+static const size_t HASH_HEX_LENGTH = 2 * HASH_SIZE * sizeof(uint32_t);
+
+struct file_job {
+    const char* name;
+    char* owned_name; //!< Copy of name read from check list, NULL otherwise
+
+    uint32_t expected_hash[HASH_SIZE]; //!< Only in check mode
+
+    uint32_t hash[HASH_SIZE];
+    size_t size;
+
+    int error; //!< errno of failed open or read, 0 if hashed successfully
+};
+
+static int hash_stream(const int fd, file_job* const job) {
+    unsigned char* chunk = (unsigned char*) malloc(READ_CHUNK_SIZE);
+    if (chunk == NULL)
+        return errno;
+
+    sha256_context context = {};
+    sha256_init(&context);
+
+    ssize_t bytes_read = 0;
+    while ((bytes_read = read(fd, chunk, READ_CHUNK_SIZE)) != 0) {
+        if (bytes_read < 0) {
+            if (errno == EINTR)
+                continue;
+
+            const int error = errno;
+            free(chunk);
+            return error;
+        }
+
+        sha256_update(&context, chunk, (size_t) bytes_read);
+        job->size += (size_t) bytes_read;
+    }
+
+    sha256_final(&context, job->hash);
+
+    free(chunk);
+    return 0;
+}
+
+static int hash_file(file_job* const job) {
+    const bool is_stdin = strcmp(job->name, "-") == 0;
+
+    const int fd = is_stdin ? STDIN_FILENO : open(job->name, O_RDONLY);
+    if (fd < 0)
+        return errno;
+
+    struct stat file_stat = {};
+    if (fstat(fd, &file_stat) != 0) {
+        const int error = errno;
+        if (!is_stdin)
+            close(fd);
+
+        return error;
+    }
+
+    int error = 0;
+    void* mapping = MAP_FAILED;
+
+    // Pipes, devices and empty files can't be mapped
+    if (S_ISREG(file_stat.st_mode) && file_stat.st_size > 0)
+        mapping = mmap(NULL, (size_t) file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (mapping != MAP_FAILED) {
+        job->size = (size_t) file_stat.st_size;
+
+        madvise(mapping, job->size, MADV_SEQUENTIAL);
+        hash_with_sha_256(mapping, job->size, job->hash);
+
+        munmap(mapping, job->size);
+    } else
+        error = hash_stream(fd, job);
+
+    if (!is_stdin)
+        close(fd);
+
+    return error;
+}
+
+struct worker_pool {
+    file_job* jobs;
+    size_t number_of_jobs;
+
+    size_t next_job; //!< Shared between workers, taken atomically
+};
+
+static void* hash_files_worker(void* raw_pool) {
+    worker_pool* pool = (worker_pool*) raw_pool;
+
+    size_t job = 0;
+    while ((job = __atomic_fetch_add(&pool->next_job, 1, __ATOMIC_RELAXED)) < pool->number_of_jobs)
+        pool->jobs[job].error = hash_file(&pool->jobs[job]);
+
+    return NULL;
+}
+
+static void hash_files(file_job* const jobs, const size_t number_of_jobs,
+                       unsigned number_of_threads) {
+
+    if (number_of_threads > number_of_jobs)
+        number_of_threads = (unsigned) number_of_jobs;
+
+    worker_pool pool = { .jobs = jobs, .number_of_jobs = number_of_jobs, .next_job = 0 };
+
+    // Calling thread is a worker too
+    pthread_t* workers = (pthread_t*) calloc(number_of_threads + 1, sizeof(*workers));
+
+    unsigned started = 1;
+    if (workers != NULL)
+        for (; started < number_of_threads; ++ started)
+            if (pthread_create(&workers[started], NULL, hash_files_worker, &pool) != 0)
+                break; // Fewer threads just take longer
+
+    hash_files_worker(&pool);
+
+    for (unsigned i = 1; i < started; ++ i)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+}
+
+static void print_hash(FILE* stream, const uint32_t hash[HASH_SIZE]) {
+    for (size_t i = 0; i < HASH_SIZE; ++ i)
+        fprintf(stream, "%08x", hash[i]);
+}
+
+static bool parse_hash(const char* hex, uint32_t hash[HASH_SIZE]) {
+    for (size_t i = 0; i < HASH_SIZE; ++ i) {
+        hash[i] = 0;
+
+        for (size_t digit = 0; digit < 2 * sizeof(uint32_t); ++ digit) {
+            const char current = hex[i * 2 * sizeof(uint32_t) + digit];
+
+            uint32_t value = 0;
+            if      (current >= '0' && current <= '9') value = (uint32_t) (current - '0');
+            else if (current >= 'a' && current <= 'f') value = (uint32_t) (current - 'a' + 10);
+            else if (current >= 'A' && current <= 'F') value = (uint32_t) (current - 'A' + 10);
+            else
+                return false;
+
+            hash[i] = hash[i] << 4 | value;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Read lines "<hash>  <file>" (or "<hash> *<file>"), like ones this tool
+ * prints, from list, jobs and their owned names are allocated and owned
+ * by caller.
+ * Malformed lines are reported and skipped, but make list ill_formed.
+ */
+static bool read_check_list(FILE* list, const char* list_name,
+                            file_job** jobs, size_t* number_of_jobs, bool* ill_formed) {
+
+    size_t capacity = 16;
+    *number_of_jobs = 0;
+    *jobs = (file_job*) calloc(capacity, sizeof(**jobs));
+
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length = 0;
+
+    bool out_of_memory = false;
+
+    for (size_t line_number = 1; *jobs != NULL && !out_of_memory &&
+             (length = getline(&line, &line_capacity, list)) != -1; ++ line_number) {
+
+        // Strip line ending
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            line[-- length] = '\0';
+
+        if (length == 0)
+            continue;
+
+        file_job job = {};
+
+        if ((size_t) length < HASH_HEX_LENGTH + 2 || !parse_hash(line, job.expected_hash) ||
+            line[HASH_HEX_LENGTH] != ' ' || (line[HASH_HEX_LENGTH + 1] != ' ' &&
+                                             line[HASH_HEX_LENGTH + 1] != '*')) {
+
+            fprintf(stderr, "sha256: %s:%zu: improperly formatted line\n", list_name, line_number);
+            *ill_formed = true;
+            continue;
+        }
+
+        job.name = job.owned_name = strdup(line + HASH_HEX_LENGTH + 2);
+        if (job.owned_name == NULL) {
+            out_of_memory = true;
+            break;
+        }
+
+        if (*number_of_jobs == capacity) {
+            capacity *= 2;
+
+            file_job* new_jobs = (file_job*) realloc(*jobs, capacity * sizeof(**jobs));
+            if (new_jobs == NULL) {
+                free(job.owned_name);
+                out_of_memory = true;
+                break;
+            }
+
+            *jobs = new_jobs;
+        }
+
+        (*jobs)[(*number_of_jobs) ++] = job;
+    }
+
+    free(line);
+    return *jobs != NULL && !out_of_memory && !ferror(list);
+}
+
+static double seconds_since(const timespec* start) {
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void print_throughput(const file_job* jobs, const size_t number_of_jobs,
+                             const double seconds, const unsigned number_of_threads) {
+    size_t total_size = 0;
+    for (size_t i = 0; i < number_of_jobs; ++ i)
+        total_size += jobs[i].size;
+
+    fprintf(stderr, "sha256: %zu bytes in %zu files, %.3f s on %u threads, %.1f MB/s\n",
+            total_size, number_of_jobs, seconds, number_of_threads,
+            seconds > 0 ? (double) total_size / seconds / 1e6 : 0.0);
+}
+
+static void print_usage(FILE* stream) {
+    fprintf(stream,
+            "Usage: sha256 [OPTION]... [FILE]...\n"
+            "Print or check SHA-256 hashes of files, \"-\" or no files mean stdin.\n"
+            "\n"
+            "  -c, --check        read hashes from FILEs and check files they list\n"
+            "  -j, --jobs N       hash N files at once (one per processor by default)\n"
+            "  -t, --throughput   report hashed bytes and speed to stderr\n"
+            "  -h, --help         show this help\n");
+}
+
+int main(int argc, char* argv[]) {
+    bool check = false, throughput = false;
+    unsigned number_of_threads = (unsigned) sysconf(_SC_NPROCESSORS_ONLN);
+
+    const char** files = (const char**) calloc((size_t) argc + 1, sizeof(*files));
+    size_t number_of_files = 0;
+
+    if (files == NULL) {
+        perror("sha256");
+        return EXIT_FAILURE;
+    }
+
+    for (int i = 1; i < argc; ++ i) {
+        const char* arg = argv[i];
+
+        if (strcmp(arg, "-c") == 0 || strcmp(arg, "--check") == 0)
+            check = true;
+        else if (strcmp(arg, "-t") == 0 || strcmp(arg, "--throughput") == 0)
+            throughput = true;
+        else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            print_usage(stdout);
+            free(files);
+            return EXIT_SUCCESS;
+        } else if (strcmp(arg, "-j") == 0 || strcmp(arg, "--jobs") == 0) {
+            if (i + 1 == argc || atoi(argv[i + 1]) <= 0) {
+                print_usage(stderr);
+                free(files);
+                return EXIT_FAILURE;
+            }
+
+            number_of_threads = (unsigned) atoi(argv[++ i]);
+        } else
+            files[number_of_files ++] = arg;
+    }
+
+    if (number_of_files == 0)
+        files[number_of_files ++] = "-";
+
+    if (number_of_threads == 0)
+        number_of_threads = 1;
+
+    file_job* jobs = NULL;
+    size_t number_of_jobs = 0;
+
+    int status = EXIT_SUCCESS;
+
+    if (check) {
+        // Every list is read first, so all listed files are hashed together
+        for (size_t i = 0; i < number_of_files; ++ i) {
+            const bool is_stdin = strcmp(files[i], "-") == 0;
+
+            FILE* list = is_stdin ? stdin : fopen(files[i], "r");
+            if (list == NULL) {
+                fprintf(stderr, "sha256: %s: %s\n", files[i], strerror(errno));
+                status = EXIT_FAILURE;
+                continue;
+            }
+
+            file_job* list_jobs = NULL;
+            size_t number_of_list_jobs = 0;
+            bool ill_formed = false;
+
+            if (!read_check_list(list, files[i], &list_jobs, &number_of_list_jobs, &ill_formed)) {
+                fprintf(stderr, "sha256: %s: %s\n", files[i], strerror(errno));
+                status = EXIT_FAILURE;
+            }
+
+            if (ill_formed)
+                status = EXIT_FAILURE;
+
+            if (!is_stdin)
+                fclose(list);
+
+            file_job* new_jobs = (file_job*)
+                realloc(jobs, (number_of_jobs + number_of_list_jobs + 1) * sizeof(*jobs));
+
+            if (new_jobs != NULL) {
+                jobs = new_jobs;
+
+                memcpy(jobs + number_of_jobs, list_jobs, number_of_list_jobs * sizeof(*jobs));
+                number_of_jobs += number_of_list_jobs;
+            } else {
+                perror("sha256");
+                status = EXIT_FAILURE;
+
+                for (size_t j = 0; j < number_of_list_jobs; ++ j)
+                    free(list_jobs[j].owned_name);
+            }
+
+            free(list_jobs);
+        }
+    } else {
+        jobs = (file_job*) calloc(number_of_files, sizeof(*jobs));
+
+        if (jobs == NULL) {
+            perror("sha256");
+            free(files);
+            return EXIT_FAILURE;
+        }
+
+        for (size_t i = 0; i < number_of_files; ++ i)
+            jobs[number_of_jobs ++].name = files[i];
+    }
+
+    timespec start = {};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    hash_files(jobs, number_of_jobs, number_of_threads);
+
+    const double seconds = seconds_since(&start);
+
+    for (size_t i = 0; i < number_of_jobs; ++ i) {
+        const file_job* job = &jobs[i];
+
+        if (job->error != 0) {
+            fprintf(check ? stdout : stderr, "%s%s: %s\n", check ? "FAILED open or read, " : "sha256: ",
+                    job->name, strerror(job->error));
+
+            status = EXIT_FAILURE;
+            continue;
+        }
+
+        if (check) {
+            const bool matches = memcmp(job->hash, job->expected_hash, sizeof(job->hash)) == 0;
+            printf("%s: %s\n", job->name, matches ? "OK" : "FAILED");
+
+            if (!matches)
+                status = EXIT_FAILURE;
+        } else {
+            print_hash(stdout, job->hash);
+            printf("  %s\n", job->name);
+        }
+    }
+
+    if (throughput)
+        print_throughput(jobs, number_of_jobs, seconds, number_of_threads);
+
+    for (size_t i = 0; i < number_of_jobs; ++ i)
+        free(jobs[i].owned_name);
+
+    free(jobs);
+    free(files);
+
+    return status;
+}
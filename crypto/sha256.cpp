@@ -1,9 +1,15 @@
 #include "crypto.h"
+#include "sha256-backends.h"
 
-#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <byteswap.h>
 #include <assert.h>
+#include <cpuid.h>
+#include <immintrin.h>
+
+// Multi-buffer vectors never cross non inlined calls, so their ABI doesn't
+// matter, but GCC reports it only after the whole file is compiled
+#pragma GCC diagnostic ignored "-Wpsabi"
 
 static const size_t BITS_IN_BYTE = 8;
 
@@ -75,319 +81,519 @@ static const uint32_t K[64] = {
     0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
-// Message data processing stage
-enum separating_stage {
-    WRITE_COMPLETED_WORDS,
-    WRITE_LAST_WORD,
-    WRITE_PADDING_ZEROS,
-    WRITE_SIZE, FINISHED
-};
-
-struct message_data {
-    const unsigned char* const data;
-    const size_t size;
-
-    size_t bytes_read;
-    separating_stage stage;
-};
-
-static message_data construct_message_data(const void* data, size_t size) {
-    return { (const unsigned char*) data, size, 0, WRITE_COMPLETED_WORDS };
-}
-
 // This number is mandated by the SHA-256 specification
 static const size_t WORDS_IN_MESSAGE = 16;
 
-static inline bool test_for_little_endian(void) {
-    // Use volatile to prevent compiler optimizations
-    volatile uint32_t value = 0x01234567;
-    return *((volatile uint8_t*) (&value)) == 0x67;
-    // Same number with bytes reversed        ^~~~
-}
-
-// Calculate endian only once
-static const bool is_little_endian = test_for_little_endian();
-
 #define MIN(a, b)               \
    ({ __typeof__ (a) __a = (a); \
       __typeof__ (b) __b = (b); \
      __a < __b ? __a : __b; })
 
-inline static bool message_write_completed_words(message_data* const data,
-                                                 uint32_t* const message,
-                                                 size_t* const written_words) {
-
-    const size_t total_of_completed_words =
-        (data->size - data->bytes_read) / sizeof(uint32_t);
+// Message words are big endian, regardless of the machine
+inline static void load_message_block(const unsigned char block[SHA_256_BLOCK_SIZE],
+                                      uint32_t message[WORDS_IN_MESSAGE]) {
+    for (size_t i = 0; i < WORDS_IN_MESSAGE; ++ i)
+        message[i] = (uint32_t) block[4 * i    ] << 24 | (uint32_t) block[4 * i + 1] << 16 |
+                     (uint32_t) block[4 * i + 2] <<  8 | (uint32_t) block[4 * i + 3];
+}
 
-    const size_t completed_words_in_this_message =
-        MIN(WORDS_IN_MESSAGE, total_of_completed_words);
+inline static void generate_message_schedule(uint32_t words[64]) {
+    for (int i = 16; i < 64; ++ i)
+        words[i] = sigma1(words[i -  2]) + words[i -  7]
+                 + sigma0(words[i - 15]) + words[i - 16];
+}
 
-    // Write full 32 bit words to the output array, if there's too
-    // many of them, we're taking first 512 bits (16 of 32 bit words)
-    for (size_t i = 0LU; i < completed_words_in_this_message; ++ i)
-        message[(*written_words) ++] =
-            ((const uint32_t*) (data->data + data->bytes_read))[i];
+static const __uint32_t H[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
 
-    data->bytes_read += completed_words_in_this_message * sizeof(uint32_t);
+// Registers for compression stage of computing SHA-256.
+// They named according to the standard. Order and according number matters.
+enum registers {
+    REG_A, REG_B, REG_C,
+    REG_D, REG_E, REG_F,
+    REG_G, REG_H, NUM_REGISTERS
+};
 
-    if (total_of_completed_words >= WORDS_IN_MESSAGE) {
-        if (total_of_completed_words == WORDS_IN_MESSAGE)
-            data->stage = WRITE_LAST_WORD;
+// Instead of moving values between registers after every round, names
+// of the registers are rotated: H of this round is A of the next one.
+#define SHA_256_ROUND(a, b, c, d, e, f, g, h, i)                                \
+    do {                                                                        \
+        const uint32_t t1 = h + upsigma1(e) + choice(e, f, g) + K[i] + schedule[i], \
+                       t2 = upsigma0(a) + maj(a, b, c);                         \
+                                                                                \
+        d += t1;      /* D will become E after the round */                     \
+        h  = t1 + t2; /* H will become A after the round */                     \
+    } while (false)
+
+inline static void compress(const uint32_t schedule[64],
+                            uint32_t registers[NUM_REGISTERS]) {
 
-        return true; // Otherwise stage remains same: writing completed words
+    uint32_t a = registers[REG_A], b = registers[REG_B],
+             c = registers[REG_C], d = registers[REG_D],
+             e = registers[REG_E], f = registers[REG_F],
+             g = registers[REG_G], h = registers[REG_H];
+
+    // After eight rounds names are back in place
+    for (int i = 0; i < 64; i += 8) {
+        SHA_256_ROUND(a, b, c, d, e, f, g, h, i + 0);
+        SHA_256_ROUND(h, a, b, c, d, e, f, g, i + 1);
+        SHA_256_ROUND(g, h, a, b, c, d, e, f, i + 2);
+        SHA_256_ROUND(f, g, h, a, b, c, d, e, i + 3);
+        SHA_256_ROUND(e, f, g, h, a, b, c, d, i + 4);
+        SHA_256_ROUND(d, e, f, g, h, a, b, c, i + 5);
+        SHA_256_ROUND(c, d, e, f, g, h, a, b, i + 6);
+        SHA_256_ROUND(b, c, d, e, f, g, h, a, i + 7);
     }
 
-    // This stage is completed, but there's still space for next one
-    return false; 
+    registers[REG_A] += a, registers[REG_B] += b;
+    registers[REG_C] += c, registers[REG_D] += d;
+    registers[REG_E] += e, registers[REG_F] += f;
+    registers[REG_G] += g, registers[REG_H] += h;
 }
 
-inline static void message_write_last_word(message_data* const data,
-                                           uint32_t* const message,
-                                           size_t* const written_words) {
+#undef SHA_256_ROUND
 
-    // Last stage ensures that there's enough space
-    // for completion of this one, so it always succeeds.
+void __sha256_process_blocks_scalar(const unsigned char* blocks, size_t number_of_blocks,
+                                    uint32_t registers[NUM_REGISTERS]) {
 
-    // Write '1' that separates data and padding
-    uint32_t last_data_word = 0x80; // 10000000 in binary
+    for (; number_of_blocks > 0; -- number_of_blocks, blocks += SHA_256_BLOCK_SIZE) {
+        uint32_t message[64];
+        load_message_block(blocks, message);
 
-    if (data->size % 4LU != 0) {
-        const size_t bytes_left = data->size - data->bytes_read;
+        // Generate another 64 - 16 message entries:
+        generate_message_schedule(message);
+
+        // Compression stage, use previous values in registers for it:
+        compress(message, registers);
+    }
+}
+
+/**
+ * Intel SHA extensions do two rounds per sha256rnds2, but they keep
+ * registers as ABEF and CDGH pairs, so state is shuffled in and out.
+ */
+__attribute__((target("sha,sse4.1")))
+void __sha256_process_blocks_sha_ni(const unsigned char* blocks, size_t number_of_blocks,
+                                    uint32_t registers[NUM_REGISTERS]) {
+
+    // Reverses bytes in every word, message is big endian
+    const __m128i BYTE_SWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    __m128i dcba = _mm_loadu_si128((const __m128i*) &registers[REG_A]),
+            hgfe = _mm_loadu_si128((const __m128i*) &registers[REG_E]);
 
-        for (size_t i = bytes_left; i > 0; -- i) {
-            last_data_word <<= BITS_IN_BYTE; // Shift left one byte
+    __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1),
+            efgh = _mm_shuffle_epi32(hgfe, 0x1B);
 
-            // Insert byte in the free space
-            last_data_word |= *(data->data + data->bytes_read + i - 1);
+    __m128i abef = _mm_alignr_epi8(cdab, efgh, 8),
+            cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+
+    for (; number_of_blocks > 0; -- number_of_blocks, blocks += SHA_256_BLOCK_SIZE) {
+        const __m128i starting_abef = abef, starting_cdgh = cdgh;
+
+        __m128i message[4];
+        for (int i = 0; i < 4; ++ i)
+            message[i] = _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i*) (blocks + 16 * i)), BYTE_SWAP);
+
+        // Four rounds per iteration, schedule is computed along the way
+        #pragma GCC unroll 16
+        for (int i = 0; i < 16; ++ i) {
+            if (i >= 4)
+                message[i % 4] = _mm_sha256msg2_epu32(
+                    _mm_add_epi32(_mm_sha256msg1_epu32(message[i % 4], message[(i + 1) % 4]),
+                                  _mm_alignr_epi8(message[(i + 3) % 4], message[(i + 2) % 4], 4)),
+                    message[(i + 3) % 4]);
+
+            const __m128i words_with_constants =
+                _mm_add_epi32(message[i % 4], _mm_loadu_si128((const __m128i*) &K[4 * i]));
+
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, words_with_constants);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(words_with_constants, 0x0E));
         }
+
+        abef = _mm_add_epi32(abef, starting_abef);
+        cdgh = _mm_add_epi32(cdgh, starting_cdgh);
     }
 
-    // TODO: Fix this function for big endian
+    const __m128i feba = _mm_shuffle_epi32(abef, 0x1B),
+                  dchg = _mm_shuffle_epi32(cdgh, 0xB1);
 
-    message[(*written_words) ++] = last_data_word;
-    data->stage = WRITE_PADDING_ZEROS;
+    _mm_storeu_si128((__m128i*) &registers[REG_A], _mm_blend_epi16(feba, dchg, 0xF0));
+    _mm_storeu_si128((__m128i*) &registers[REG_E], _mm_alignr_epi8(dchg, feba, 8));
 }
 
-// Size according to SHA-256 specification spans 64 bits
-const size_t SIZE_SPANS_WORDS = sizeof(uint64_t) / sizeof(uint32_t);
+bool __sha256_has_sha_extensions(void) {
+    __builtin_cpu_init(); // Could be called before constructors
 
-inline static bool message_write_padding_zeros(uint32_t* const message,
-                                               size_t* const written_words) {
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
 
-    size_t space_for_size = 0;
+    // SHA extensions are reported in extended features leaf
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & bit_SHA))
+        return false;
 
-    // If we can place size in this message, then reserve space for it:
-    if (WORDS_IN_MESSAGE - *written_words >= SIZE_SPANS_WORDS)
-        space_for_size = SIZE_SPANS_WORDS;
+    return __builtin_cpu_supports("sse4.1");
+}
 
-    while (*written_words + space_for_size < WORDS_IN_MESSAGE)
-        message[(*written_words) ++] = 0U;
+typedef void (*process_blocks_fn_t)(const unsigned char* blocks, size_t number_of_blocks,
+                                    uint32_t registers[NUM_REGISTERS]);
 
-    if (WORDS_IN_MESSAGE - *written_words < SIZE_SPANS_WORDS)
-        return true; // Stage remains same, next block will be zeros & size
+static void process_blocks_resolve(const unsigned char* blocks, size_t number_of_blocks,
+                                   uint32_t registers[NUM_REGISTERS]);
 
-    // This stage ensures that there's enough space left for
-    // completing the next one
-    return false;
-}
+// Constant initialized, so it works even for callers from other static initializers
+static process_blocks_fn_t process_blocks_implementation = process_blocks_resolve;
 
-inline static void message_write_size(message_data* const data,
-                                      uint32_t* const message,
-                                      size_t* const written_words) {
+// Check processor only once, on the first call
+static void process_blocks_resolve(const unsigned char* blocks, size_t number_of_blocks,
+                                   uint32_t registers[NUM_REGISTERS]) {
 
-    assert(*written_words == WORDS_IN_MESSAGE - SIZE_SPANS_WORDS);
+    const process_blocks_fn_t chosen = __sha256_has_sha_extensions() ?
+        __sha256_process_blocks_sha_ni : __sha256_process_blocks_scalar;
 
-    uint64_t message_size = data->size * BITS_IN_BYTE;
-    if (is_little_endian)
-        message_size = __bswap_64(message_size);
-
-    *(uint64_t*) &message[*written_words] = message_size;
-    data->stage = FINISHED;
+    __atomic_store_n(&process_blocks_implementation, chosen, __ATOMIC_RELAXED);
+    chosen(blocks, number_of_blocks, registers);
 }
 
-// Returns true if new message were constructed id est you
-// can use it in while like so:
+static inline void process_blocks(const unsigned char* blocks, size_t number_of_blocks,
+                                  uint32_t registers[NUM_REGISTERS]) {
+    __atomic_load_n(&process_blocks_implementation, __ATOMIC_RELAXED)(
+        blocks, number_of_blocks, registers);
+}
 
-// while(get_next_message_block(...))
-//     ... // Processs block
+void sha256_init(sha256_context* const context) {
+    // Fill registers with H0 values
+    memcpy(context->state, H, sizeof(context->state));
 
-inline static void swap_words_endian(uint32_t* words, size_t size) {
-    for (size_t i = 0; i < size; ++ i)
-        words[i] = __bswap_32(words[i]);
+    context->buffered_size = 0;
+    context->total_size = 0;
 }
 
-inline static bool get_next_message_block(message_data* const data,
-                                          uint32_t message[WORDS_IN_MESSAGE]) {
+void sha256_update(sha256_context* const context,
+                   const void* const data_ptr, const size_t size) {
+
+    const unsigned char* data = (const unsigned char*) data_ptr;
+    size_t data_left = size;
 
-    size_t written_words = 0;
+    context->total_size += size;
 
-    switch (data->stage) {
-    default:
-        fprintf(stderr, "Illegal state!");
+    // Complete block, that previous update left unfinished
+    if (context->buffered_size > 0) {
+        const size_t taken = MIN(SHA_256_BLOCK_SIZE - context->buffered_size, data_left);
 
-        [[fallthrough]];
+        memcpy(context->buffer + context->buffered_size, data, taken);
+        context->buffered_size += taken;
 
-    case FINISHED:
-        return false; // All the data has already been processed
+        data += taken, data_left -= taken;
 
-    case WRITE_COMPLETED_WORDS:
-        if (message_write_completed_words(data, message, &written_words))
-            break;
+        if (context->buffered_size < SHA_256_BLOCK_SIZE)
+            return; // Still not enough for a block
 
-        [[fallthrough]];
+        process_blocks(context->buffer, 1, context->state);
+        context->buffered_size = 0;
+    }
+
+    // Full blocks are hashed right from the input, without copying
+    const size_t full_blocks = data_left / SHA_256_BLOCK_SIZE;
+    process_blocks(data, full_blocks, context->state);
 
-    case WRITE_LAST_WORD:
-        message_write_last_word(data, message, &written_words);
+    data += full_blocks * SHA_256_BLOCK_SIZE;
+    data_left -= full_blocks * SHA_256_BLOCK_SIZE;
 
-        [[fallthrough]];
+    memcpy(context->buffer, data, data_left);
+    context->buffered_size = data_left;
+}
 
-    case WRITE_PADDING_ZEROS:
-        if (message_write_padding_zeros(message, &written_words))
-            break;
+void sha256_final(sha256_context* const context, uint32_t output_hash[HASH_SIZE]) {
+    // Size according to SHA-256 specification spans 64 bits
+    const uint64_t size_in_bits = context->total_size * BITS_IN_BYTE;
 
-        [[fallthrough]];
+    unsigned char* buffer = context->buffer;
+    size_t used = context->buffered_size;
 
-    case WRITE_SIZE:
-        message_write_size(data, message, &written_words);
-        // After this stage data gets marked as finished, so
-        // this function will return false on the next call
+    // Write '1' that separates data and padding
+    buffer[used ++] = 0x80; // 10000000 in binary
+
+    // Size doesn't fit in this block, it goes to the next one
+    if (used > SHA_256_BLOCK_SIZE - sizeof(uint64_t)) {
+        memset(buffer + used, 0, SHA_256_BLOCK_SIZE - used);
+        process_blocks(buffer, 1, context->state);
+
+        used = 0;
     }
 
-    if (is_little_endian)
-        swap_words_endian(message, WORDS_IN_MESSAGE);
+    memset(buffer + used, 0, SHA_256_BLOCK_SIZE - sizeof(uint64_t) - used);
+
+    for (size_t i = 0; i < sizeof(uint64_t); ++ i)
+        buffer[SHA_256_BLOCK_SIZE - 1 - i] = (unsigned char) (size_in_bits >> (i * BITS_IN_BYTE));
+
+    process_blocks(buffer, 1, context->state);
 
-    return true; // This function has written some data
+    memcpy(output_hash, context->state, sizeof(context->state));
 }
 
-inline static void generate_message_schedule(uint32_t words[64]) {
-    for (int i = 16; i < 64; ++ i)
-        words[i] = sigma1(words[i -  2]) + words[i -  7]
-                 + sigma0(words[i - 15]) + words[i - 16];
+void hash_with_sha_256(const void* const data_ptr,
+                       const size_t size,
+                       uint32_t output_hash[8]) {
+
+    sha256_context context = {};
+    sha256_init(&context);
+
+    sha256_update(&context, data_ptr, size);
+    sha256_final(&context, output_hash);
 }
 
-static const __uint32_t H[8] = {
-    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
-    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
-};
+// ------------------------- MULTI-BUFFER -------------------------
+
+/**
+ * Independent messages are hashed in SIMD lanes, lane i of every vector
+ * holds value for i-th message. Written with GCC vector extensions, so
+ * the same code becomes AVX2 or AVX-512, depending on where it's inlined.
+ */
+template <typename V>
+__attribute__((always_inline))
+inline static V rotr_lanes(const V value, const int count) {
+    return value >> count | value << (32 - count);
+}
+
+template <typename V>
+__attribute__((always_inline))
+inline static void compress_lanes(V registers[NUM_REGISTERS], V message[WORDS_IN_MESSAGE]) {
+    V a = registers[REG_A], b = registers[REG_B], c = registers[REG_C], d = registers[REG_D],
+      e = registers[REG_E], f = registers[REG_F], g = registers[REG_G], h = registers[REG_H];
+
+    // Fully unrolled, so schedule and registers stay in vector registers
+    #pragma GCC unroll 64
+    for (size_t i = 0; i < 64; ++ i) {
+        // Schedule is kept only for last 16 rounds, that's all it depends on
+        V& word = message[i % WORDS_IN_MESSAGE];
+
+        if (i >= WORDS_IN_MESSAGE) {
+            const V w2  = message[(i -  2) % WORDS_IN_MESSAGE],
+                    w7  = message[(i -  7) % WORDS_IN_MESSAGE],
+                    w15 = message[(i - 15) % WORDS_IN_MESSAGE];
+
+            word += (rotr_lanes(w2, 17) ^ rotr_lanes(w2, 19) ^ (w2 >> 10)) + w7 +
+                    (rotr_lanes(w15, 7) ^ rotr_lanes(w15, 18) ^ (w15 >> 3));
+        }
+
+        const V t1 = h + (rotr_lanes(e, 6) ^ rotr_lanes(e, 11) ^ rotr_lanes(e, 25)) +
+                     ((e & f) | (~e & g)) + K[i] + word;
 
-inline static int modulo(int a, int b) {
-    int mod = a % b;
+        const V t2 = (rotr_lanes(a, 2) ^ rotr_lanes(a, 13) ^ rotr_lanes(a, 22)) +
+                     ((a & (b | c)) | (b & c));
 
-    if (mod < 0)
-        mod = (b < 0) ? mod - b : mod + b;
+        h = g, g = f, f = e, e = d + t1;
+        d = c, c = b, b = a, a = t1 + t2;
+    }
 
-    return mod;
+    registers[REG_A] += a, registers[REG_B] += b, registers[REG_C] += c, registers[REG_D] += d;
+    registers[REG_E] += e, registers[REG_F] += f, registers[REG_G] += g, registers[REG_H] += h;
 }
 
-inline static uint32_t* modulo_get(uint32_t* array, int index, int size) {
-    return &array[modulo(index, size)];
-};
+// Message ends with one or two blocks of remaining data, padding and size
+static size_t write_padded_tail(const unsigned char* data, size_t size,
+                                unsigned char tail[2 * SHA_256_BLOCK_SIZE]) {
 
-// Registers for compression stage of computing SHA-256.
-// They named according to the standard. Order and according number matters.
-enum registers {
-    REG_A, REG_B, REG_C,
-    REG_D, REG_E, REG_F,
-    REG_G, REG_H, NUM_REGISTERS
+    const size_t tail_size = size % SHA_256_BLOCK_SIZE;
+    const size_t tail_blocks = tail_size + 1 + sizeof(uint64_t) > SHA_256_BLOCK_SIZE ? 2 : 1;
+
+    memset(tail, 0, tail_blocks * SHA_256_BLOCK_SIZE);
+    memcpy(tail, data + size - tail_size, tail_size);
+
+    tail[tail_size] = 0x80; // 10000000 in binary
+
+    const uint64_t size_in_bits = size * BITS_IN_BYTE;
+    unsigned char* end = tail + tail_blocks * SHA_256_BLOCK_SIZE;
+
+    for (size_t i = 0; i < sizeof(uint64_t); ++ i)
+        end[-1 - (ptrdiff_t) i] = (unsigned char) (size_in_bits >> (i * BITS_IN_BYTE));
+
+    return tail_blocks;
+}
+
+// Message, that goes to a lane, messages are ordered by number of blocks
+struct lane_order {
+    size_t blocks;
+    size_t index;
 };
 
-inline static void compress(uint32_t schedule[64],
-                            uint32_t registers[NUM_REGISTERS]) {
+/**
+ * Hash up to LANES messages at once, group lists their indices. Lanes run
+ * in lockstep, so the longest message decides how many blocks every lane
+ * processes.
+ */
+template <typename V, size_t LANES>
+__attribute__((always_inline))
+inline static void hash_lanes(const void* const inputs[], const size_t sizes[],
+                              const lane_order group[], const size_t count,
+                              uint32_t outputs[][HASH_SIZE]) {
+
+    static const unsigned char EMPTY_BLOCK[SHA_256_BLOCK_SIZE] = {};
 
-    uint32_t starting_values[8];
-    memcpy(starting_values, registers, sizeof(starting_values));
+    unsigned char tails[LANES][2 * SHA_256_BLOCK_SIZE];
+    size_t full_blocks[LANES] = {}, total_blocks[LANES] = {}, max_blocks = 0;
 
-    for (int i = 0; i < 64; ++ i) {
-        #define GET_REG(reg) \
-            modulo_get(registers, REG_##reg - i, NUM_REGISTERS)
+    for (size_t lane = 0; lane < count; ++ lane) {
+        const size_t message = group[lane].index;
 
-        uint32_t a = *GET_REG(A), b = *GET_REG(B), c = *GET_REG(C),
-                 e = *GET_REG(E), f = *GET_REG(F), g = *GET_REG(G),
-                 h = *GET_REG(H);
+        full_blocks[lane] = sizes[message] / SHA_256_BLOCK_SIZE;
+        total_blocks[lane] = full_blocks[lane] +
+            write_padded_tail((const unsigned char*) inputs[message], sizes[message], tails[lane]);
 
-        uint32_t t1 = upsigma1(e) + choice(e, f, g) + h + K[i] + schedule[i],
-                 t2 = upsigma0(a) +    maj(a, b, c);
+        if (total_blocks[lane] > max_blocks)
+            max_blocks = total_blocks[lane];
+    }
+
+    V registers[NUM_REGISTERS];
+    for (size_t i = 0; i < NUM_REGISTERS; ++ i)
+        registers[i] = V {} + H[i];
+
+    for (size_t block = 0; block < max_blocks; ++ block) {
+        alignas(V) uint32_t words[WORDS_IN_MESSAGE][LANES];
+
+        // Transpose: word i of every message becomes i-th vector
+        for (size_t lane = 0; lane < LANES; ++ lane) {
+            const unsigned char* data = EMPTY_BLOCK;
+
+            if (block < full_blocks[lane])
+                data = (const unsigned char*) inputs[group[lane].index] + block * SHA_256_BLOCK_SIZE;
+            else if (block < total_blocks[lane])
+                data = tails[lane] + (block - full_blocks[lane]) * SHA_256_BLOCK_SIZE;
+
+            for (size_t i = 0; i < WORDS_IN_MESSAGE; ++ i) {
+                uint32_t word = 0;
+                memcpy(&word, data + i * sizeof(word), sizeof(word)); // Data can be unaligned
+
+                words[i][lane] = __builtin_bswap32(word);
+            }
+        }
 
-        // H will become A after the cycle:
-        *GET_REG(H) = t1 + t2;
+        V message[WORDS_IN_MESSAGE];
+        memcpy(message, words, sizeof(message));
 
-        // D will become E after the cycle:
-        *GET_REG(D) += t1;
+        compress_lanes(registers, message);
 
-        #undef GET_REG
+        // Finished lanes keep computing garbage, their result is taken now
+        for (size_t lane = 0; lane < count; ++ lane)
+            if (block + 1 == total_blocks[lane])
+                for (size_t i = 0; i < NUM_REGISTERS; ++ i)
+                    outputs[group[lane].index][i] = registers[i][lane];
     }
+}
+
+// Lanes longer than that many medians are hashed one by one instead
+static const size_t LONG_LANE_FACTOR = 4;
 
-    for (int i = 0; i < 8; ++ i)
-        registers[i] += starting_values[i];
+static int compare_lane_orders(const void* first, const void* second) {
+    const size_t first_blocks  = ((const lane_order*)  first)->blocks,
+                 second_blocks = ((const lane_order*) second)->blocks;
+
+    return (first_blocks > second_blocks) - (first_blocks < second_blocks);
 }
 
-void hash_with_sha_256(const void* const data_ptr,
-                       const size_t size,
-                       uint32_t output_hash[8]) {
+/**
+ * Group costs as much as it's longest message, so messages are grouped
+ * by length. Few very long ones would still hold up a whole group of
+ * shorter neighbours, they're left to single buffer hashing.
+ */
+template <typename V, size_t LANES>
+__attribute__((always_inline))
+inline static void hash_sorted_lanes(const void* const inputs[], const size_t sizes[],
+                                     const size_t count, uint32_t outputs[][HASH_SIZE]) {
+
+    lane_order* order = (lane_order*) malloc(count * sizeof(*order));
+
+    if (order == NULL) {
+        __sha256_hash_many_one_by_one(inputs, sizes, count, outputs);
+        return;
+    }
 
-    uint32_t message[64];
+    for (size_t i = 0; i < count; ++ i)
+        order[i] = { .blocks = sizes[i] / SHA_256_BLOCK_SIZE + 1, .index = i };
 
-    message_data data =
-        construct_message_data(data_ptr, size);
+    qsort(order, count, sizeof(*order), compare_lane_orders);
 
-    // Fill registers with H0 values
-    memcpy(output_hash, H, 8 * sizeof(uint32_t));
+    size_t lanes_end = count;
+    if (count > 0) {
+        const size_t long_lane = LONG_LANE_FACTOR * order[count / 2].blocks;
 
-    while(get_next_message_block(&data, message)) {
-        // Generate another 64 - 16 message entries:
-        generate_message_schedule(message);
+        while (lanes_end > 0 && order[lanes_end - 1].blocks > long_lane)
+            -- lanes_end;
+    }
 
-        // Compression stage, use previous values in registers for it:
-        compress(message, output_hash);
+    for (size_t i = lanes_end; i < count; ++ i) {
+        const size_t message = order[i].index;
+        hash_with_sha_256(inputs[message], sizes[message], outputs[message]);
     }
+
+    for (size_t i = 0; i < lanes_end; i += LANES)
+        hash_lanes<V, LANES>(inputs, sizes, order + i, MIN(LANES, lanes_end - i), outputs);
+
+    free(order);
 }
 
-static void print_bitwise_representation(unsigned char value) {
-    for (int i = BITS_IN_BYTE - 1; i >= 0; -- i)
-        printf("%hd", (value & (0x1 << i)) != 0);
+typedef uint32_t avx2_lanes   __attribute__((vector_size(32)));
+typedef uint32_t avx512_lanes __attribute__((vector_size(64)));
+
+__attribute__((target("avx2")))
+void __sha256_hash_many_avx2(const void* const inputs[], const size_t sizes[],
+                             const size_t count, uint32_t outputs[][HASH_SIZE]) {
+    hash_sorted_lanes<avx2_lanes, sizeof(avx2_lanes) / sizeof(uint32_t)>(
+        inputs, sizes, count, outputs);
 }
 
-static void print_word(uint32_t word) {
-    for (size_t j = 0; j < sizeof(word); ++ j) {
-        print_bitwise_representation(*((unsigned char*) &word + j));
-        printf(" ");
-    }
+__attribute__((target("avx512f")))
+void __sha256_hash_many_avx512(const void* const inputs[], const size_t sizes[],
+                               const size_t count, uint32_t outputs[][HASH_SIZE]) {
+    hash_sorted_lanes<avx512_lanes, sizeof(avx512_lanes) / sizeof(uint32_t)>(
+        inputs, sizes, count, outputs);
 }
 
-static void print_words(uint32_t* words, size_t size) {
-    for (size_t i = 0; i < size; ++ i) {
-        print_word(words[i]);
-        printf("\n");
-    }
+void __sha256_hash_many_one_by_one(const void* const inputs[], const size_t sizes[],
+                                   const size_t count, uint32_t outputs[][HASH_SIZE]) {
+    for (size_t i = 0; i < count; ++ i)
+        hash_with_sha_256(inputs[i], sizes[i], outputs[i]);
 }
 
-#include <malloc.h>
+typedef void (*hash_many_fn_t)(const void* const inputs[], const size_t sizes[],
+                               const size_t count, uint32_t outputs[][HASH_SIZE]);
+
+static void hash_many_resolve(const void* const inputs[], const size_t sizes[],
+                              const size_t count, uint32_t outputs[][HASH_SIZE]);
 
-int main(void) {
-    char* my_string; scanf("%ms", &my_string);
+// Constant initialized, so it works even for callers from other static initializers
+static hash_many_fn_t hash_many = hash_many_resolve;
 
-    uint32_t registers[8];
-    hash_with_sha_256(my_string, strlen(my_string), registers);
+static hash_many_fn_t choose_hash_many(void) {
+    __builtin_cpu_init(); // Could be called before constructors
 
-    for (int i = 0; i < 8; ++ i)
-        printf("%08x", registers[i]);
+    if (__builtin_cpu_supports("avx512f"))
+        return __sha256_hash_many_avx512;
 
-    printf("\n");
+    // Eight lanes lose to SHA extensions hashing messages one by one
+    if (__sha256_has_sha_extensions())
+        return __sha256_hash_many_one_by_one;
 
-    free(my_string);
+    if (__builtin_cpu_supports("avx2"))
+        return __sha256_hash_many_avx2;
+
+    return __sha256_hash_many_one_by_one;
+}
 
-    // ==> value: 0b00000000000000000011111111111111
-    // ---------------------------------------------
-    //    sigma0: 0b11110001111111111100011110000000
-    //    sigma1: 0b00011000000000000110000000001111
-    //  upsigma0: 0b00111111000001111111001111111110
-    //  upsigma1: 0b00000011111111111111111101111000
+// Check processor only once, on the first call
+static void hash_many_resolve(const void* const inputs[], const size_t sizes[],
+                              const size_t count, uint32_t outputs[][HASH_SIZE]) {
+
+    const hash_many_fn_t chosen = choose_hash_many();
+
+    __atomic_store_n(&hash_many, chosen, __ATOMIC_RELAXED);
+    chosen(inputs, sizes, count, outputs);
+}
 
-    //    driver: 0b00000000111111110000000011111111
-    //         a: 0b00000000000000001111111111111111
-    //         b: 0b11111111111111110000000000000000
-    // ---------------------------------------------
-    //    choice: 0b11111111000000000000000011111111
-    //       maj: 0b00000000111111110000000011111111
+void hash_with_sha_256_many(const void* const inputs[], const size_t sizes[],
+                            const size_t count, uint32_t outputs[][HASH_SIZE]) {
+    __atomic_load_n(&hash_many, __ATOMIC_RELAXED)(inputs, sizes, count, outputs);
 }
@@ -0,0 +1,197 @@
+#include "tree-hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+// Prefixes, that keep leaves and nodes from being confused with each other
+static const unsigned char LEAF_PREFIX = 0x00, NODE_PREFIX = 0x01;
+
+static void hash_leaf(const tree_hash* const tree, const unsigned char* const data,
+                      const size_t leaf, uint32_t hash[HASH_SIZE]) {
+
+    const size_t start = leaf * tree->leaf_size,
+                 size  = tree->data_size - start < tree->leaf_size ?
+                         tree->data_size - start : tree->leaf_size;
+
+    sha256_context context = {};
+    sha256_init(&context);
+
+    sha256_update(&context, &LEAF_PREFIX, sizeof(LEAF_PREFIX));
+    sha256_update(&context, data + start, size);
+
+    sha256_final(&context, hash);
+}
+
+static void hash_node(const uint32_t left[HASH_SIZE], const uint32_t right[HASH_SIZE],
+                      uint32_t hash[HASH_SIZE]) {
+
+    unsigned char children[1 + 2 * HASH_SIZE * sizeof(uint32_t)] = { NODE_PREFIX };
+
+    for (size_t i = 0; i < 2 * HASH_SIZE; ++ i) {
+        const uint32_t word = i < HASH_SIZE ? left[i] : right[i - HASH_SIZE];
+
+        for (size_t byte = 0; byte < sizeof(word); ++ byte)
+            children[1 + i * sizeof(word) + byte] = (unsigned char) (word >> (24 - 8 * byte));
+    }
+
+    hash_with_sha_256(children, sizeof(children), hash);
+}
+
+static size_t parent_level_size(const size_t level_size) {
+    return (level_size + 1) / 2;
+}
+
+static size_t count_nodes(size_t level_size) {
+    size_t nodes = level_size;
+
+    for (; level_size > 1; level_size = parent_level_size(level_size))
+        nodes += parent_level_size(level_size);
+
+    return nodes;
+}
+
+struct leaf_hashing_job {
+    tree_hash* tree;
+    const unsigned char* data;
+
+    size_t next_leaf; //!< Shared between workers, taken atomically
+};
+
+static void* hash_leaves_worker(void* raw_job) {
+    leaf_hashing_job* job = (leaf_hashing_job*) raw_job;
+
+    size_t leaf = 0;
+    while ((leaf = __atomic_fetch_add(&job->next_leaf, 1, __ATOMIC_RELAXED)) < job->tree->leaves)
+        hash_leaf(job->tree, job->data, leaf, job->tree->nodes[leaf]);
+
+    return NULL;
+}
+
+static bool hash_leaves(tree_hash* const tree, const unsigned char* const data,
+                        unsigned number_of_threads) {
+
+    if (number_of_threads == 0)
+        number_of_threads = (unsigned) sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (number_of_threads > tree->leaves)
+        number_of_threads = (unsigned) tree->leaves;
+
+    leaf_hashing_job job = { .tree = tree, .data = data, .next_leaf = 0 };
+
+    // Calling thread is a worker too
+    pthread_t* workers = (pthread_t*) calloc(number_of_threads, sizeof(*workers));
+    if (workers == NULL)
+        return false;
+
+    unsigned started = 1;
+    for (; started < number_of_threads; ++ started)
+        if (pthread_create(&workers[started], NULL, hash_leaves_worker, &job) != 0)
+            break; // Fewer threads just take longer
+
+    hash_leaves_worker(&job);
+
+    for (unsigned i = 1; i < started; ++ i)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+    return true;
+}
+
+bool tree_hash_create(tree_hash* const tree, const void* const data, const size_t size,
+                      const size_t leaf_size, const unsigned number_of_threads) {
+
+    if (leaf_size == 0) {
+        *tree = {};
+        return false; // Data would never be split into leaves
+    }
+
+    tree->leaf_size = leaf_size;
+    tree->data_size = size;
+
+    tree->leaves = size == 0 ? 1 : (size + leaf_size - 1) / leaf_size;
+
+    tree->nodes = (uint32_t (*)[HASH_SIZE]) calloc(count_nodes(tree->leaves), sizeof(*tree->nodes));
+    if (tree->nodes == NULL)
+        return false;
+
+    if (!hash_leaves(tree, (const unsigned char*) data, number_of_threads)) {
+        tree_hash_destroy(tree);
+        return false;
+    }
+
+    // Upper levels are tiny compared to leaves, they're hashed sequentially
+    uint32_t (*level)[HASH_SIZE] = tree->nodes;
+    for (size_t level_size = tree->leaves; level_size > 1; ) {
+        uint32_t (*parents)[HASH_SIZE] = level + level_size;
+
+        for (size_t i = 0; i + 1 < level_size; i += 2)
+            hash_node(level[i], level[i + 1], parents[i / 2]);
+
+        if (level_size % 2 == 1)
+            memcpy(parents[level_size / 2], level[level_size - 1], sizeof(*level));
+
+        level = parents, level_size = parent_level_size(level_size);
+    }
+
+    return true;
+}
+
+void tree_hash_root(const tree_hash* const tree, uint32_t root[HASH_SIZE]) {
+    memcpy(root, tree->nodes[count_nodes(tree->leaves) - 1], sizeof(*tree->nodes));
+}
+
+bool tree_hash_verify_range(const tree_hash* const tree, const uint32_t expected_root[HASH_SIZE],
+                            const void* const data, const size_t offset, const size_t size) {
+
+    if (offset + size > tree->data_size)
+        return false;
+
+    size_t first = offset / tree->leaf_size,
+           last  = size == 0 ? first : (offset + size - 1) / tree->leaf_size;
+
+    if (last >= tree->leaves)
+        first = last = tree->leaves - 1; // Empty range at the very end
+
+    // Hashes of the range's span on current level, recomputed from data
+    uint32_t (*span)[HASH_SIZE] = (uint32_t (*)[HASH_SIZE]) calloc(last - first + 1, sizeof(*span));
+    if (span == NULL)
+        return false;
+
+    for (size_t leaf = first; leaf <= last; ++ leaf)
+        hash_leaf(tree, (const unsigned char*) data, leaf, span[leaf - first]);
+
+    // Siblings outside of the span are taken from the stored tree
+    const uint32_t (*level)[HASH_SIZE] = tree->nodes;
+    for (size_t level_size = tree->leaves; level_size > 1; ) {
+        #define NODE(index) (index >= first && index <= last ? span[index - first] : level[index])
+
+        for (size_t parent = first / 2; parent <= last / 2; ++ parent) {
+            uint32_t hash[HASH_SIZE];
+
+            if (2 * parent + 1 < level_size)
+                hash_node(NODE(2 * parent), NODE(2 * parent + 1), hash);
+            else
+                memcpy(hash, NODE(2 * parent), sizeof(hash));
+
+            // Parents are written in order, so children aren't overwritten before use
+            memcpy(span[parent - first / 2], hash, sizeof(hash));
+        }
+
+        #undef NODE
+
+        level += level_size, level_size = parent_level_size(level_size);
+        first /= 2, last /= 2;
+    }
+
+    const bool matches = memcmp(span[0], expected_root, sizeof(*span)) == 0;
+
+    free(span);
+    return matches;
+}
+
+void tree_hash_destroy(tree_hash* const tree) {
+    free(tree->nodes);
+    *tree = {};
+}
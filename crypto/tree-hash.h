@@ -0,0 +1,52 @@
+#pragma once
+
+#include "crypto.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Merkle tree of SHA-256 hashes over fixed size leaves of a buffer.
+ * Leaves are independent, so they're hashed in parallel, and any
+ * subrange can be verified by rehashing only leaves it touches.
+ *
+ * Tree is defined as follows (tree root is not equal to plain
+ * #hash_with_sha_256 of the buffer):
+ *   - leaf hash is SHA-256(0x00 || leaf bytes), last leaf can be shorter,
+ *     empty buffer has one empty leaf;
+ *   - node hash is SHA-256(0x01 || left hash || right hash), hashes are
+ *     serialized as big endian words;
+ *   - every level pairs up nodes of the previous one, last node without
+ *     a pair is carried to the next level unchanged.
+ */
+struct tree_hash {
+    size_t leaf_size;
+    size_t data_size;
+
+    size_t leaves;
+    uint32_t (*nodes)[HASH_SIZE]; //!< Levels one after another, leaves first
+};
+
+const size_t TREE_HASH_DEFAULT_LEAF_SIZE = 1 << 20;
+
+/**
+ * Hash size bytes of data into tree, leaves are hashed on number_of_threads
+ * threads (0 means one per online processor).
+ * @return false if leaf_size is 0 or memory couldn't be allocated
+ */
+bool tree_hash_create(tree_hash* const tree, const void* const data, const size_t size,
+                      const size_t leaf_size = TREE_HASH_DEFAULT_LEAF_SIZE,
+                      const unsigned number_of_threads = 0);
+
+void tree_hash_root(const tree_hash* const tree, uint32_t root[HASH_SIZE]);
+
+/**
+ * Check, that bytes [offset, offset + size) of data match tree with
+ * expected root. Only leaves that overlap range are rehashed, rest of
+ * the tree supplies sibling hashes on the way to the root. Data is the
+ * whole buffer, because leaves at the range's edges are hashed whole.
+ */
+bool tree_hash_verify_range(const tree_hash* const tree, const uint32_t expected_root[HASH_SIZE],
+                            const void* const data, const size_t offset, const size_t size);
+
+void tree_hash_destroy(tree_hash* const tree);
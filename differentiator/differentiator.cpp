@@ -35,9 +35,16 @@ struct variable {
     const char* name;
 };
 
+// Nodes are tiny, numerous and never freed one by one
+static safe_arena expression_arena = {};
+
 expression_node* expression_node_create() {
+    if (expression_arena.first == NULL)
+        TRY safe_arena_create(&expression_arena)
+            THROW("Arena for nodes creation failed!");
+
     expression_node* node = NULL;
-    TRY safe_calloc(1, &node)
+    TRY safe_arena_alloc(&expression_arena, 1, &node)
         THROW("Memory allocation for node failed!");
 
     return node;
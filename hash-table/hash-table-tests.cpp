@@ -52,6 +52,31 @@ TEST(populate_hash_table_with_chars) {
     CALL_TEST_FINALIZER();
 }
 
+TEST(shrink_hash_table_after_deletion) {
+    hash_table<int, int> table;
+
+    TRY hash_table_create(&table, int_hash, 1024, 1024)
+        ASSERT_SUCCESS();
+
+    TEST_FINALIZER({ hash_table_destroy(&table); });
+
+    for (int i = 0; i < 100; ++ i)
+        hash_table_insert(&table, i, i * i);
+
+    for (int i = 0; i < 100; i += 2)
+        hash_table_delete(&table, i);
+
+    TRY hash_table_shrink_to_fit(&table)
+        ASSERT_SUCCESS();
+
+    ASSERT_EQUAL((int) table.values.capacity, 50);
+
+    for (int i = 1; i < 100; i += 2)
+        HASH_TABLE_ASSERT_VALUE(&table, i, i * i);
+
+    CALL_TEST_FINALIZER();
+}
+
 TEST(test_hash_table_inline_construction) {
     hash_table<char, int> table =
         HASH_TABLE(char, int, char_hash,
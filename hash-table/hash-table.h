@@ -170,6 +170,28 @@ void hash_table_rehash_keep_size(hash_table<K, V>* table) {
     hash_table_rehash(table, table->buckets_capacity, table->values.capacity);
 }
 
+template <typename K, typename V>
+static void __hash_table_fix_moved_value(element_index_t old_index,
+                                         element_index_t new_index,
+                                         void* context) {
+    hash_table<K, V>* table = (hash_table<K, V>*) context;
+
+    K key = linked_list_get_pointer(&table->values, new_index)->element.key;
+    hash_table_bucket* bucket = __hash_table_lookup_bucket(table, key);
+
+    // Only first value of the bucket is referenced
+    if (bucket->value_index == old_index)
+        bucket->value_index = new_index;
+}
+
+template <typename K, typename V>
+stack_trace* hash_table_shrink_to_fit(hash_table<K, V>* table) {
+    TRY linked_list_compact(&table->values, __hash_table_fix_moved_value<K, V>, table)
+        FAIL("Failed to compact hash table values!");
+
+    return SUCCESS();
+}
+
 template <typename K, typename V>
 bool hash_table_delete(hash_table<K, V>* table, K key) {
     hash_table_bucket* bucket = NULL;
@@ -179,6 +201,11 @@ bool hash_table_delete(hash_table<K, V>* table, K key) {
     if (index == linked_list_end_index)
         return false;
 
+    // Bucket shouldn't keep referencing deleted value
+    if (bucket->value_index == index)
+        bucket->value_index =
+            linked_list_get_pointer(&table->values, index)->next_index;
+
     TRY linked_list_delete(&table->values, index)
         THROW("Value deletion failed!");
 
@@ -224,7 +251,7 @@ bool hash_table_insert(hash_table<K, V>* table, K key, V value) {
 template <typename K, typename V>
 void hash_table_destroy(hash_table<K, V>* table) {
     linked_list_destroy(&table->values);
-    free(table->hash_table), table->hash_table = NULL;
+    safe_free(table->hash_table), table->hash_table = NULL;
 }
 
 template <typename K, typename V>
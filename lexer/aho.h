@@ -206,7 +206,7 @@ inline void raw_trie_replace_state(raw_trie* target_trie, raw_trie* from, raw_tr
 inline void raw_trie_destroy_without_neighbours(raw_trie* graph) {
     // Dangerous?
     hash_table_destroy(&graph->transitions);
-    free(graph);
+    safe_free(graph);
 }
 
 inline raw_trie* regex_kleene_transform(raw_trie* begin, raw_trie* end) {
@@ -1,10 +1,12 @@
 #include "linked-list.h"
+#include "versioned-linked-list.h"
 #include "test-framework.h"
 
 #include "simple-stack.h"
 #include "trace.h"
 #include <cstdio>
 #include <stdlib.h>
+#include <pthread.h>
 
 typedef char* frame_t;
 
@@ -76,6 +78,36 @@ TEST(populate_linked_list_with_lots_of_elements) {
 }
 
 
+TEST(grow_linked_list_in_mapped_buffer) {
+    // Small threshold, so list crosses it both ways
+    const safe_buffer_policy policy = { .mmap_threshold = 4096, .huge_pages = true };
+
+    linked_list<int> list = {};
+    TRY linked_list_create(&list, 10, &policy)
+        ASSERT_SUCCESS();
+
+    const int num_elements = 50000;
+    for (int i = 0; i < num_elements; ++ i)
+        TRY linked_list_push_back(&list, i, NULL)
+            ASSERT_SUCCESS();
+
+    for (int i = 0; i < num_elements - 10; ++ i)
+        TRY linked_list_pop_back(&list)
+            ASSERT_SUCCESS();
+
+    TRY linked_list_compact(&list)
+        ASSERT_SUCCESS();
+
+    // Elements are popped from the head
+    int index = num_elements - 10;
+    LINKED_LIST_TRAVERSE(&list, int, current)
+        ASSERT_EQUAL(current->element, index ++);
+
+    ASSERT_EQUAL(index, num_elements);
+
+    linked_list_destroy(&list);
+}
+
 TEST(populate_linked_list_with_different_values) {
     linked_list<int> list = {};
     TRY linked_list_create(&list, 10)
@@ -121,6 +153,261 @@ TEST(populate_linked_list_with_different_values) {
     linked_list_destroy(&list);
 }
 
+struct sort_entry {
+    int key;
+    int order; // Position before sorting, to check stability
+};
+
+static bool sort_entry_less(const sort_entry* first, const sort_entry* second) {
+    return first->key < second->key;
+}
+
+TEST(sort_linked_list_stably) {
+    linked_list<sort_entry> list = {};
+    TRY linked_list_create(&list, 10)
+        ASSERT_SUCCESS();
+
+    // Enough elements to be sorted on multiple threads
+    const int num_elements = 50000;
+    for (int i = 0; i < num_elements; ++ i)
+        linked_list_push_front(&list, { (i * 7919) % 1000, i });
+
+    TRY linked_list_sort(&list, sort_entry_less, 4)
+        ASSERT_SUCCESS();
+
+    ASSERT_EQUAL((int) list.used, num_elements);
+    ASSERT_EQUAL(list.is_linearized, true);
+
+    sort_entry previous = { -1, 0 };
+    LINKED_LIST_TRAVERSE(&list, sort_entry, current) {
+        ASSERT_EQUAL(previous.key <= current->element.key, true);
+
+        // Pushed to front, so equal keys should go in descending order
+        if (previous.key == current->element.key)
+            ASSERT_EQUAL(previous.order > current->element.order, true);
+
+        previous = current->element;
+    }
+
+    ASSERT_EQUAL(linked_list_tail(&list)->element.key, previous.key);
+
+    linked_list_destroy(&list);
+}
+
+TEST(splice_range_of_linked_list) {
+    linked_list<int> list = {};
+    TRY linked_list_create(&list, 10)
+        ASSERT_SUCCESS();
+
+    element_index_t places[6];
+    for (int i = 0; i < 6; ++ i)
+        linked_list_push_back(&list, i, &places[i]);
+
+    TRY linked_list_splice(&list, places[4], &list, places[1], places[2])
+        ASSERT_SUCCESS();
+    ASSERT_CONTENT(&list, int, 0, 3, 4, 1, 2, 5);
+
+    TRY linked_list_splice(&list, linked_list_end_index, &list, places[2], places[5])
+        ASSERT_SUCCESS();
+    ASSERT_CONTENT(&list, int, 2, 5, 0, 3, 4, 1);
+
+    linked_list<int> other = {};
+    TRY linked_list_create(&other, 10)
+        ASSERT_SUCCESS();
+
+    TRY linked_list_splice(&other, linked_list_end_index, &list, places[0], places[4])
+        ASSERT_SUCCESS();
+    ASSERT_CONTENT(&list,  int, 2, 5, 1);
+    ASSERT_CONTENT(&other, int, 0, 3, 4);
+
+    linked_list_destroy(&other);
+    linked_list_destroy(&list);
+}
+
+static bool fails(stack_trace* trace) {
+    const bool failed = !trace_is_success(trace);
+    trace_destruct(trace);
+
+    return failed;
+}
+
+TEST(reject_invalid_splice) {
+    linked_list<int> list = {}, other = {};
+    TRY linked_list_create(&list, 10)
+        ASSERT_SUCCESS();
+
+    TRY linked_list_create(&other, 10)
+        ASSERT_SUCCESS();
+
+    element_index_t places[6];
+    for (int i = 0; i < 6; ++ i)
+        linked_list_push_back(&list, i, &places[i]);
+
+    TRY linked_list_delete(&list, places[5])
+        ASSERT_SUCCESS();
+
+    // Position is one of the range ends
+    ASSERT_EQUAL(fails(linked_list_splice(&list, places[3], &list, places[1], places[3])), true);
+
+    // Position or range end is free
+    ASSERT_EQUAL(fails(linked_list_splice(&list, places[5], &list, places[0], places[1])), true);
+    ASSERT_EQUAL(fails(linked_list_splice(&other, linked_list_end_index,
+                                          &list, places[4], places[5])), true);
+
+    // Range ends are swapped, nothing may be moved then
+    ASSERT_EQUAL(fails(linked_list_splice(&other, linked_list_end_index,
+                                          &list, places[3], places[1])), true);
+
+    ASSERT_CONTENT(&list, int, 0, 1, 2, 3, 4);
+    ASSERT_EQUAL((int) other.used, 0);
+
+    linked_list_destroy(&other);
+    linked_list_destroy(&list);
+}
+
+struct compaction_moves {
+    int total;
+    int towards_front;
+};
+
+static void count_moved_element(element_index_t old_index, element_index_t new_index,
+                                void* context) {
+    compaction_moves* moves = (compaction_moves*) context;
+
+    ++ moves->total;
+    if (old_index > new_index)
+        ++ moves->towards_front;
+}
+
+TEST(compact_linked_list) {
+    linked_list<int> list = {};
+    TRY linked_list_create(&list, 10)
+        ASSERT_SUCCESS();
+
+    element_index_t places[40];
+    for (int i = 0; i < 40; ++ i)
+        linked_list_push_back(&list, i, &places[i]);
+
+    for (int i = 0; i < 40; ++ i)
+        if (i % 4 != 0)
+            linked_list_delete(&list, places[i]);
+
+    compaction_moves moves = {};
+    TRY linked_list_compact(&list, count_moved_element, &moves)
+        ASSERT_SUCCESS();
+
+    ASSERT_EQUAL((int) list.capacity, 10);
+    ASSERT_EQUAL(moves.total, 7); // All except 0 and 4 were out of prefix
+    ASSERT_EQUAL(moves.towards_front, moves.total);
+    ASSERT_CONTENT(&list, int, 0, 4, 8, 12, 16, 20, 24, 28, 32, 36);
+
+    // List should still be able to grow after shrinking
+    for (int i = 40; i < 60; ++ i)
+        linked_list_push_back(&list, i);
+
+    ASSERT_EQUAL((int) list.used, 30);
+    ASSERT_LOGICAL_POSITION(&list, int, 29, 59);
+
+    linked_list_destroy(&list);
+}
+
+#define ASSERT_SNAPSHOT_CONTENT(table, type, ...)                           \
+    do {                                                                    \
+        type __expected_content[] = { __VA_ARGS__ };                        \
+        ASSERT_EQUAL((int) (table)->used, (int) sizeof(__expected_content) /\
+                     (int) sizeof (*__expected_content));                   \
+                                                                            \
+        element_index_t count = 0;                                          \
+        VERSIONED_LINKED_LIST_TRAVERSE(table, type, current)                \
+            ASSERT_EQUAL(__expected_content[count ++], current->element);   \
+    } while(false)
+
+TEST(snapshot_of_versioned_linked_list_stays_unchanged) {
+    versioned_linked_list<int> list = {};
+    TRY versioned_linked_list_create(&list)
+        ASSERT_SUCCESS();
+
+    element_index_t places[3];
+    for (int i = 0; i < 3; ++ i)
+        versioned_linked_list_push_back(&list, i, &places[i]);
+
+    versioned_linked_list_snapshot<int> snapshot = {};
+    versioned_linked_list_take_snapshot(&list, &snapshot);
+
+    versioned_linked_list_delete(&list, places[1]);
+    versioned_linked_list_push_front(&list, 42);
+    versioned_linked_list_set(&list, places[2], 7);
+
+    ASSERT_SNAPSHOT_CONTENT(snapshot.table, int, 0, 1, 2);
+    ASSERT_SNAPSHOT_CONTENT(list.table, int, 42, 0, 7);
+
+    // Pages that weren't modified are still shared
+    for (int i = 0; i < 200; ++ i)
+        versioned_linked_list_push_back(&list, i);
+
+    ASSERT_EQUAL(snapshot.table->number_of_pages, 1LU);
+    ASSERT_EQUAL(list.table->number_of_pages, 4LU);
+
+    versioned_linked_list_snapshot_release(&snapshot);
+    versioned_linked_list_destroy(&list);
+}
+
+struct snapshot_reader_task {
+    versioned_linked_list_snapshot<int> snapshot;
+    long sum;
+};
+
+static void* read_snapshot(void* raw_task) {
+    snapshot_reader_task* task = (snapshot_reader_task*) raw_task;
+
+    task->sum = 0;
+    VERSIONED_LINKED_LIST_TRAVERSE(task->snapshot.table, int, current)
+        task->sum += current->element;
+
+    versioned_linked_list_snapshot_release(&task->snapshot);
+    return NULL;
+}
+
+TEST(read_snapshots_while_modifying_versioned_linked_list) {
+    versioned_linked_list<int> list = {};
+    TRY versioned_linked_list_create(&list)
+        ASSERT_SUCCESS();
+
+    const int num_readers = 8, num_elements = 10000;
+
+    pthread_t readers[num_readers];
+    snapshot_reader_task tasks[num_readers];
+
+    long expected_sums[num_readers];
+    long sum = 0;
+
+    for (int i = 0, reader = 0; i < num_elements; ++ i) {
+        element_index_t index = -1;
+        versioned_linked_list_push_front(&list, i, &index);
+        sum += i;
+
+        if (i % 3 == 0) {
+            versioned_linked_list_delete(&list, index);
+            sum -= i;
+        }
+
+        if ((i + 1) % (num_elements / num_readers) == 0) {
+            versioned_linked_list_take_snapshot(&list, &tasks[reader].snapshot);
+            expected_sums[reader] = sum;
+
+            pthread_create(&readers[reader], NULL, read_snapshot, &tasks[reader]);
+            ++ reader;
+        }
+    }
+
+    for (int i = 0; i < num_readers; ++ i) {
+        pthread_join(readers[i], NULL);
+        ASSERT_EQUAL(tasks[i].sum == expected_sums[i], true);
+    }
+
+    versioned_linked_list_destroy(&list);
+}
+
 TEST(test_linked_list) {
     linked_list<int> list;
     linked_list_create(&list, 10);
@@ -1,12 +1,15 @@
 #pragma once
 
 #include "trace.h"
+#include "safe-alloc.h"
 
 #include <stdlib.h>
 #include <stdbool.h>
 #include <malloc.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
 
 typedef int element_index_t;
 
@@ -26,6 +29,9 @@ struct linked_list {
 
     element_index_t free;
     bool is_linearized;
+
+    // Where elements live, NULL means heap
+    const safe_buffer_policy* buffer_policy;
 };
 
 
@@ -83,19 +89,21 @@ inline element_index_t linked_list_get_index(linked_list<E>* list,
 
 
 template <typename E>
-stack_trace* linked_list_create(linked_list<E>* list, const size_t capacity = 10) {
-    element<E>* new_space = (element<E>*)
-        calloc(capacity + 2 /* For two terminal nodes */, sizeof(*new_space));
+stack_trace* linked_list_create(linked_list<E>* list, const size_t capacity = 10,
+                                const safe_buffer_policy* buffer_policy = NULL) {
+    element<E>* new_space = NULL;
 
-    if (new_space == NULL)
-        return FAILURE(RUNTIME_ERROR, strerror(errno));
+    TRY safe_buffer_resize(&new_space, 0, capacity + 2 /* For two terminal nodes */,
+                           buffer_policy)
+        FAIL("List allocation failed!");
 
     list->elements = new_space;
     list->capacity = capacity;
+    list->buffer_policy = buffer_policy;
 
     list->is_linearized = true;
 
-    // Memory is assumed to be zeroed after calloc
+    // Memory is assumed to be zeroed after creation
     linked_list_head(list)->is_free = false;
 
     // Loop first free element on itself
@@ -130,14 +138,9 @@ stack_trace* check_index(linked_list<E>* list, element_index_t index) {
 
 template <typename E>
 stack_trace* linked_list_resize(linked_list<E>* list, const size_t new_capacity) {
-    element<E>* new_space = (element<E>*)
-        realloc(list->elements, sizeof(*new_space) *
-                (new_capacity + 2) /* For terminal nodes */);
-
-    if (new_space == NULL)
-        return FAILURE(RUNTIME_ERROR, strerror(errno));
-
-    list->elements = new_space;
+    TRY safe_buffer_resize(&list->elements, list->capacity + 2 /* For terminal nodes */,
+                           new_capacity + 2, list->buffer_policy)
+        FAIL("List resizing failed!");
 
     for (element_index_t i = list->capacity + 2; i <= (element_index_t) new_capacity + 1; ++ i)
         add_free_element(list, i);
@@ -148,6 +151,84 @@ stack_trace* linked_list_resize(linked_list<E>* list, const size_t new_capacity)
 }
 
 
+typedef void (*linked_list_on_move_fn_t) (element_index_t old_index,
+                                          element_index_t new_index,
+                                          void* context);
+
+/**
+ * Move all live elements to the beginning of element array and give
+ * memory occupied by free elements back, it's the opposite of resize.
+ *
+ * Every moved element is reported to on_move (after it was moved) exactly
+ * once, so holders of element indexes can fix them up in a single pass.
+ * Logical order is preserved, but physical one isn't, so list stops
+ * being linearized if anything moves.
+ */
+template <typename E>
+stack_trace* linked_list_compact(linked_list<E>* list,
+                                 linked_list_on_move_fn_t on_move = NULL,
+                                 void* context = NULL) {
+
+    // After compaction live elements occupy [1, used]
+    const element_index_t last_live_index = (element_index_t) list->used;
+
+    element_index_t free_index = 1,
+                    live_index = (element_index_t) list->capacity + 1;
+
+    while (true) {
+        while (free_index <= last_live_index && !is_free_element(list, free_index))
+            ++ free_index;
+
+        if (free_index > last_live_index)
+            break; // Every element in [1, used] is live, we're done
+
+        // There's a hole in the prefix, so some live element is out of it
+        while (is_free_element(list, live_index))
+            -- live_index;
+
+        element<E>* moved = linked_list_get_pointer(list, live_index);
+
+        list->elements[moved->prev_index].next_index = free_index;
+        list->elements[moved->next_index].prev_index = free_index;
+
+        list->elements[free_index] = *moved;
+        moved->is_free = true;
+
+        if (on_move != NULL)
+            on_move(live_index, free_index, context);
+
+        list->is_linearized = false;
+    }
+
+    // List always needs at least one free element in stock
+    size_t new_capacity = list->used > 0 ? list->used : 1;
+
+    stack_trace* shrink_trace =
+        safe_buffer_resize(&list->elements, list->capacity + 2 /* For terminal nodes */,
+                           new_capacity + 2, list->buffer_policy);
+
+    // Shrinking can't really fail, but if it does, old space is still good
+    if (!trace_is_success(shrink_trace))
+        new_capacity = list->capacity;
+
+    trace_destruct(shrink_trace);
+
+    list->capacity = new_capacity;
+
+    // Rebuild list of free elements from the scratch, like in create
+    list->free = last_live_index + 1;
+    *linked_list_get_pointer(list, list->free) =
+        { .next_index = list->free,
+          .prev_index = list->free,
+          .is_free = true, .element = (E) {} };
+
+    for (element_index_t i = (element_index_t) new_capacity + 1; i > list->free; -- i)
+        add_free_element(list, i);
+
+    return SUCCESS();
+}
+
+
 template <typename E>
 static inline
 bool free_elements_left(linked_list<E>* list) {
@@ -386,6 +467,12 @@ stack_trace* linked_list_swap(linked_list<E>* list,
 
     swap(first, second); // We've prepared elements, now we can swap
 
+    // Free list head could've been one of swapped elements, follow it
+    if (list->free == fst_index)
+        list->free = snd_index;
+    else if (list->free == snd_index)
+        list->free = fst_index;
+
     return SUCCESS();
 }
 
@@ -411,6 +498,325 @@ stack_trace* linked_list_linearize(linked_list<E>* list) {
         current = linked_list_get_pointer(list, logical_index);
     }
 
+    list->is_linearized = true;
+
+    return SUCCESS();
+}
+
+
+/**
+ * Move elements [first, last] (both inclusive, in logical order)
+ * from src right after element pos of dst.
+ *
+ * When dst and src is the same list only links get updated, so it's O(1),
+ * pos shouldn't lie inside of the moved range in this case (only range
+ * ends are checked). Different lists don't share element array, so
+ * elements get moved one by one, and range is checked to be whole first.
+ */
+template <typename E>
+stack_trace* linked_list_splice(linked_list<E>* dst, element_index_t pos,
+                                linked_list<E>* src, element_index_t first,
+                                element_index_t last) {
+
+    TRY check_index(dst, pos) FAIL("Illegal insertion position!");
+
+    TRY check_index(src, first) FAIL("Illegal first index of range!");
+    TRY check_index(src, last)  FAIL("Illegal last index of range!");
+
+    if (is_free_element(dst, pos))
+        return FAILURE(RUNTIME_ERROR, "Can't insert after free element %d!", pos);
+
+    if (is_free_element(src, first) || is_free_element(src, last))
+        return FAILURE(RUNTIME_ERROR, "Range [%d, %d] starts or ends with free element!",
+                       first, last);
+
+    if (first == linked_list_end_index || last == linked_list_end_index)
+        return FAILURE(RUNTIME_ERROR, "Terminal element can't be moved!");
+
+    if (dst == src && (pos == first || pos == last))
+        return FAILURE(RUNTIME_ERROR, "Can't insert range [%d, %d] after it's own element!",
+                       first, last);
+
+    if (dst != src) {
+        // Elements are moved one by one, so whole range is checked before touching it
+        for (element_index_t current = first; current != last;
+             current = src->elements[current].next_index)
+            if (src->elements[current].next_index == linked_list_end_index)
+                return FAILURE(RUNTIME_ERROR, "Element %d doesn't follow %d!", last, first);
+
+        element_index_t current = first;
+
+        while (true) {
+            element<E>* moved = linked_list_get_pointer(src, current);
+            const element_index_t next = moved->next_index;
+
+            TRY linked_list_insert_after(dst, moved->element, pos, &pos)
+                FAIL("Failed to move element %d to destination list!", current);
+
+            TRY linked_list_delete(src, current)
+                FAIL("Failed to remove moved element %d from source!", current);
+
+            if (current == last)
+                break;
+
+            current = next;
+        }
+
+        return SUCCESS();
+    }
+
+    element<E> *range_first = linked_list_get_pointer(src, first),
+               *range_last  = linked_list_get_pointer(src, last);
+
+    if (range_first->prev_index == pos)
+        return SUCCESS(); // Range is already in place
+
+    //         next           next           next
+    // (BEFORE) ~~~> [FIRST ... LAST] ~~~> (AFTER)   (POS) ~~~> (POS NEXT)
+    //     =>
+    // (BEFORE) ~~~> (AFTER)   (POS) ~~~> [FIRST ... LAST] ~~~> (POS NEXT)
+
+    const element_index_t before = range_first->prev_index,
+                          after  = range_last ->next_index;
+
+    src->elements[before].next_index = after;
+    src->elements[after ].prev_index = before;
+
+    const element_index_t pos_next = src->elements[pos].next_index;
+
+    src->elements[pos].next_index = first;
+    range_first->prev_index = pos;
+
+    range_last->next_index = pos_next;
+    src->elements[pos_next].prev_index = last;
+
+    src->is_linearized = false;
+
+    return SUCCESS();
+}
+
+
+template <typename E>
+using linked_list_less_fn_t = bool (*) (const E* first, const E* second);
+
+/**
+ * Merge two sorted chains of elements, linked only via next_index
+ * and terminated with #linked_list_end_index, into one sorted chain.
+ *
+ * Elements of first chain go first when equal, so merge is stable.
+ */
+template <typename E>
+static inline element_index_t
+__linked_list_merge_chains(element<E>* elements, linked_list_less_fn_t<E> less,
+                           element_index_t first, element_index_t second) {
+
+    element_index_t head = linked_list_end_index,
+                    tail = linked_list_end_index;
+
+    while (first != linked_list_end_index && second != linked_list_end_index) {
+        element_index_t taken = -1;
+
+        if (less(&elements[second].element, &elements[first].element))
+            taken = second, second = elements[second].next_index;
+        else
+            taken = first,  first  = elements[first ].next_index;
+
+        if (tail == linked_list_end_index)
+            head = taken;
+        else
+            elements[tail].next_index = taken;
+
+        tail = taken;
+    }
+
+    const element_index_t rest =
+        first != linked_list_end_index ? first : second;
+
+    if (tail == linked_list_end_index)
+        return rest;
+
+    elements[tail].next_index = rest;
+    return head;
+}
+
+/**
+ * Stable bottom-up merge sort of a chain (see #__linked_list_merge_chains),
+ * bins[i] holds sorted chain of 2^i elements, so it needs no allocations.
+ */
+template <typename E>
+static inline element_index_t
+__linked_list_sort_chain(element<E>* elements, linked_list_less_fn_t<E> less,
+                         element_index_t chain) {
+
+    const int MAX_BINS = sizeof(size_t) * 8;
+    element_index_t bins[MAX_BINS];
+
+    int bins_used = 0;
+    while (chain != linked_list_end_index) {
+        element_index_t merged = chain;
+
+        chain = elements[chain].next_index;
+        elements[merged].next_index = linked_list_end_index;
+
+        // Carry merged chain up, like in binary addition
+        int bin = 0;
+        for (; bin < bins_used && bins[bin] != linked_list_end_index; ++ bin) {
+            // Bins hold elements that came earlier, they go first
+            merged = __linked_list_merge_chains(elements, less, bins[bin], merged);
+            bins[bin] = linked_list_end_index;
+        }
+
+        bins[bin] = merged;
+        if (bin == bins_used)
+            ++ bins_used;
+    }
+
+    element_index_t sorted = linked_list_end_index;
+    for (int bin = 0; bin < bins_used; ++ bin)
+        sorted = __linked_list_merge_chains(elements, less, bins[bin], sorted);
+
+    return sorted;
+}
+
+// Runs smaller than that aren't worth starting a thread for
+const size_t LINKED_LIST_MIN_SORT_RUN = 4096;
+
+const size_t LINKED_LIST_MAX_SORT_THREADS = 64;
+
+template <typename E>
+struct __linked_list_sort_task {
+    element<E>* elements;
+    linked_list_less_fn_t<E> less;
+
+    element_index_t first_chain, second_chain;
+    element_index_t result;
+};
+
+template <typename E>
+static void* __linked_list_sort_worker(void* raw_task) {
+    __linked_list_sort_task<E>* task = (__linked_list_sort_task<E>*) raw_task;
+
+    task->result = task->second_chain == linked_list_end_index ?
+        __linked_list_sort_chain  (task->elements, task->less, task->first_chain) :
+        __linked_list_merge_chains(task->elements, task->less, task->first_chain,
+                                                               task->second_chain);
+    return NULL;
+}
+
+/**
+ * Run every task on it's own thread, if thread can't be
+ * started, task gets executed on the calling one instead.
+ */
+template <typename E>
+static inline void __linked_list_run_sort_tasks(__linked_list_sort_task<E>* tasks,
+                                                size_t number_of_tasks) {
+    pthread_t threads[LINKED_LIST_MAX_SORT_THREADS];
+    bool is_started[LINKED_LIST_MAX_SORT_THREADS];
+
+    // First task is always run by the calling thread
+    for (size_t i = 1; i < number_of_tasks; ++ i)
+        is_started[i] = pthread_create(&threads[i], NULL,
+            __linked_list_sort_worker<E>, &tasks[i]) == 0;
+
+    __linked_list_sort_worker<E>(&tasks[0]);
+
+    for (size_t i = 1; i < number_of_tasks; ++ i) {
+        if (is_started[i])
+            pthread_join(threads[i], NULL);
+        else
+            __linked_list_sort_worker<E>(&tasks[i]);
+    }
+}
+
+/**
+ * Stable sort of list in ascending order defined by less, elements
+ * aren't copied anywhere, sort works by relinking next_index only.
+ *
+ * List is split into runs that are sorted in parallel (one thread per
+ * run, at most #number_of_threads, or one per core if it's zero), then
+ * runs are merged pairwise, also in parallel. Finally list gets linearized.
+ */
+template <typename E>
+stack_trace* linked_list_sort(linked_list<E>* list, linked_list_less_fn_t<E> less,
+                              size_t number_of_threads = 0) {
+    if (less == NULL)
+        return FAILURE(RUNTIME_ERROR, "Comparator must not be NULL!");
+
+    if (list->used < 2)
+        return SUCCESS(); // Nothing to sort
+
+    if (number_of_threads == 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        number_of_threads = cores > 0 ? (size_t) cores : 1;
+    }
+
+    size_t number_of_runs = list->used / LINKED_LIST_MIN_SORT_RUN;
+
+    if (number_of_runs > number_of_threads)
+        number_of_runs = number_of_threads;
+
+    if (number_of_runs > LINKED_LIST_MAX_SORT_THREADS)
+        number_of_runs = LINKED_LIST_MAX_SORT_THREADS;
+
+    if (number_of_runs == 0)
+        number_of_runs = 1;
+
+    __linked_list_sort_task<E> tasks[LINKED_LIST_MAX_SORT_THREADS];
+
+    // Cut list into separate chains of almost equal size
+    const size_t run_size = list->used / number_of_runs;
+
+    element_index_t current = linked_list_head_index(list);
+    for (size_t run = 0; run < number_of_runs; ++ run) {
+        tasks[run] = { list->elements, less, current, linked_list_end_index, -1 };
+
+        const size_t length = run + 1 == number_of_runs ?
+            list->used - run * run_size : run_size;
+
+        element_index_t run_tail = current;
+        for (size_t i = 1; i < length; ++ i)
+            run_tail = list->elements[run_tail].next_index;
+
+        current = list->elements[run_tail].next_index;
+        list->elements[run_tail].next_index = linked_list_end_index;
+    }
+
+    __linked_list_run_sort_tasks(tasks, number_of_runs);
+
+    // Merge neighbouring runs pairwise until one is left,
+    // runs keep their order, so stability is preserved
+    while (number_of_runs > 1) {
+        const size_t number_of_merges = number_of_runs / 2;
+
+        for (size_t i = 0; i < number_of_merges; ++ i)
+            tasks[i] = { list->elements, less, tasks[2 * i    ].result,
+                                               tasks[2 * i + 1].result, -1 };
+
+        // Odd run out just waits for the next round
+        if (number_of_runs % 2 != 0)
+            tasks[number_of_merges] = {
+                list->elements, less, linked_list_end_index, linked_list_end_index,
+                tasks[number_of_runs - 1].result
+            };
+
+        __linked_list_run_sort_tasks(tasks, number_of_merges);
+        number_of_runs = (number_of_runs + 1) / 2;
+    }
+
+    // Restore prev links and terminal element, that were ignored
+    element_index_t prev = linked_list_end_index;
+    for (element_index_t index = tasks[0].result; index != linked_list_end_index;
+            index = list->elements[index].next_index) {
+        list->elements[index].prev_index = prev;
+        prev = index;
+    }
+
+    linked_list_end(list)->next_index = tasks[0].result;
+    linked_list_end(list)->prev_index = prev;
+
+    TRY linked_list_linearize(list)
+        FAIL("Failed to linearize sorted list!");
+
     return SUCCESS();
 }
 
@@ -451,7 +857,7 @@ inline stack_trace* linked_list_get_logical(linked_list<E>* const list,
 template <typename E>
 void linked_list_destroy(linked_list<E> *list) {
     if (list != NULL) {
-        free(list->elements);
+        safe_buffer_free(list->elements, list->capacity + 2, list->buffer_policy);
         *list = {}; // Zero list out
     }
 
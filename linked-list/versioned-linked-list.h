@@ -0,0 +1,436 @@
+#pragma once
+
+#include "linked-list.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/**
+ * Doubly linked list in array, that can make snapshots of itself in O(1).
+ *
+ * Element array is split into pages, that are shared between list and
+ * it's snapshots, and copied only when list modifies page for the first
+ * time after snapshot was taken (copy-on-write). Every page and page table
+ * is tagged with version in which it was created, so list can tell if it
+ * owns page exclusively without touching reference counter.
+ *
+ * Snapshot is immutable, so it can be read from any number of threads,
+ * while list keeps being modified, nobody ever waits for anyone. Snapshot
+ * has to be taken by thread that modifies list (or under the same lock).
+ */
+
+const size_t VERSIONED_LINKED_LIST_PAGE_SIZE = 64; // In elements
+
+template <typename E>
+struct versioned_linked_list_page {
+    size_t references; // Number of tables that hold this page
+    size_t version;
+
+    element<E> elements[VERSIONED_LINKED_LIST_PAGE_SIZE];
+};
+
+template <typename E>
+struct versioned_linked_list_table {
+    size_t references; // Number of snapshots (and list) holding this table
+    size_t version;
+
+    versioned_linked_list_page<E>** pages;
+    size_t number_of_pages, pages_capacity;
+
+    size_t used;
+};
+
+template <typename E>
+struct versioned_linked_list {
+    versioned_linked_list_table<E>* table;
+
+    size_t version; // Increased by every snapshot
+    element_index_t free; // Singly linked via next_index, ends with terminal
+};
+
+template <typename E>
+struct versioned_linked_list_snapshot {
+    versioned_linked_list_table<E>* table;
+};
+
+
+template <typename E>
+inline const element<E>* versioned_linked_list_get_pointer(
+        const versioned_linked_list_table<E>* table, element_index_t index) {
+
+    return &table->pages[(size_t) index / VERSIONED_LINKED_LIST_PAGE_SIZE]
+                ->elements[(size_t) index % VERSIONED_LINKED_LIST_PAGE_SIZE];
+}
+
+template <typename E>
+inline const element<E>* versioned_linked_list_end(
+        const versioned_linked_list_table<E>* table) {
+    return versioned_linked_list_get_pointer(table, linked_list_end_index);
+}
+
+template <typename E>
+inline const element<E>* versioned_linked_list_head(
+        const versioned_linked_list_table<E>* table) {
+    return versioned_linked_list_get_pointer(table,
+        versioned_linked_list_end(table)->next_index);
+}
+
+template <typename E>
+inline const element<E>* versioned_linked_list_next(
+        const versioned_linked_list_table<E>* table, const element<E>* current) {
+    return versioned_linked_list_get_pointer(table, current->next_index);
+}
+
+// Works for list->table as well as for snapshot.table
+#define VERSIONED_LINKED_LIST_TRAVERSE(table, type, current)                        \
+    for (const element<type>* current = versioned_linked_list_head(table);          \
+            current != versioned_linked_list_end (table);                           \
+            current  = versioned_linked_list_next(table, current))
+
+
+template <typename E>
+static inline void __versioned_linked_list_release_page(versioned_linked_list_page<E>* page) {
+    if (__atomic_sub_fetch(&page->references, 1, __ATOMIC_ACQ_REL) == 0)
+        free(page);
+}
+
+template <typename E>
+static inline void __versioned_linked_list_release_table(versioned_linked_list_table<E>* table) {
+    if (__atomic_sub_fetch(&table->references, 1, __ATOMIC_ACQ_REL) != 0)
+        return; // Somebody still uses this table
+
+    for (size_t i = 0; i < table->number_of_pages; ++ i)
+        __versioned_linked_list_release_page(table->pages[i]);
+
+    free(table->pages);
+    free(table);
+}
+
+static inline bool __versioned_linked_list_is_exclusive(size_t* references) {
+    return __atomic_load_n(references, __ATOMIC_ACQUIRE) == 1;
+}
+
+/**
+ * Make sure that table isn't shared with any snapshot, so it
+ * can be modified in place, after first call it's O(1).
+ */
+template <typename E>
+static inline stack_trace* __versioned_linked_list_own_table(versioned_linked_list<E>* list) {
+    versioned_linked_list_table<E>* table = list->table;
+
+    if (table->version == list->version)
+        return SUCCESS(); // Table was created after latest snapshot
+
+    if (__versioned_linked_list_is_exclusive(&table->references)) {
+        table->version = list->version; // All snapshots are gone, adopt it
+        return SUCCESS();
+    }
+
+    versioned_linked_list_table<E>* copy = (versioned_linked_list_table<E>*)
+        calloc(1, sizeof(*copy));
+
+    if (copy == NULL)
+        return FAILURE(RUNTIME_ERROR, strerror(errno));
+
+    *copy = *table;
+    copy->references = 1;
+    copy->version = list->version;
+
+    copy->pages = (versioned_linked_list_page<E>**)
+        calloc(table->pages_capacity, sizeof(*copy->pages));
+
+    if (copy->pages == NULL) {
+        free(copy);
+        return FAILURE(RUNTIME_ERROR, strerror(errno));
+    }
+
+    // Pages are shared between tables until they get modified
+    for (size_t i = 0; i < table->number_of_pages; ++ i) {
+        copy->pages[i] = table->pages[i];
+        __atomic_add_fetch(&copy->pages[i]->references, 1, __ATOMIC_RELAXED);
+    }
+
+    list->table = copy;
+    __versioned_linked_list_release_table(table);
+
+    return SUCCESS();
+}
+
+/**
+ * Get element, that can be modified without affecting snapshots,
+ * it's page gets copied, if some snapshot still uses it.
+ */
+template <typename E>
+static inline stack_trace* __versioned_linked_list_writable(versioned_linked_list<E>* list,
+                                                            element_index_t index,
+                                                            element<E>** writable) {
+    TRY __versioned_linked_list_own_table(list)
+        FAIL("Failed to take ownership of page table!");
+
+    const size_t page_index = (size_t) index / VERSIONED_LINKED_LIST_PAGE_SIZE;
+    versioned_linked_list_page<E>* page = list->table->pages[page_index];
+
+    if (page->version != list->version) {
+        if (__versioned_linked_list_is_exclusive(&page->references))
+            page->version = list->version;
+        else {
+            versioned_linked_list_page<E>* copy = (versioned_linked_list_page<E>*)
+                malloc(sizeof(*copy));
+
+            if (copy == NULL)
+                return FAILURE(RUNTIME_ERROR, strerror(errno));
+
+            memcpy(copy->elements, page->elements, sizeof(page->elements));
+            copy->references = 1;
+            copy->version = list->version;
+
+            list->table->pages[page_index] = copy;
+            __versioned_linked_list_release_page(page);
+
+            page = copy;
+        }
+    }
+
+    *writable = &page->elements[(size_t) index % VERSIONED_LINKED_LIST_PAGE_SIZE];
+    return SUCCESS();
+}
+
+template <typename E>
+static inline stack_trace* __versioned_linked_list_add_page(versioned_linked_list<E>* list) {
+    TRY __versioned_linked_list_own_table(list)
+        FAIL("Failed to take ownership of page table!");
+
+    versioned_linked_list_table<E>* table = list->table;
+
+    if (table->number_of_pages == table->pages_capacity) {
+        const size_t GROW = 2; // How much page table grows
+
+        versioned_linked_list_page<E>** new_pages = (versioned_linked_list_page<E>**)
+            realloc(table->pages, sizeof(*new_pages) * table->pages_capacity * GROW);
+
+        if (new_pages == NULL)
+            return FAILURE(RUNTIME_ERROR, strerror(errno));
+
+        table->pages = new_pages;
+        table->pages_capacity *= GROW;
+    }
+
+    versioned_linked_list_page<E>* page = (versioned_linked_list_page<E>*)
+        calloc(1, sizeof(*page));
+
+    if (page == NULL)
+        return FAILURE(RUNTIME_ERROR, strerror(errno));
+
+    page->references = 1;
+    page->version = list->version;
+
+    const element_index_t first_index = (element_index_t)
+        (table->number_of_pages * VERSIONED_LINKED_LIST_PAGE_SIZE);
+
+    table->pages[table->number_of_pages ++] = page;
+
+    // Terminal element is never free, so it's skipped on the first page
+    for (size_t i = VERSIONED_LINKED_LIST_PAGE_SIZE; i > 0; -- i) {
+        const element_index_t index = first_index + (element_index_t) i - 1;
+        if (index == linked_list_end_index)
+            break;
+
+        page->elements[i - 1] = { .next_index = list->free, .prev_index = -1,
+                                  .is_free = true, .element = (E) {} };
+        list->free = index;
+    }
+
+    return SUCCESS();
+}
+
+
+template <typename E>
+stack_trace* versioned_linked_list_create(versioned_linked_list<E>* list) {
+    *list = { .table = NULL, .version = 1, .free = linked_list_end_index };
+
+    list->table = (versioned_linked_list_table<E>*) calloc(1, sizeof(*list->table));
+    if (list->table == NULL)
+        return FAILURE(RUNTIME_ERROR, strerror(errno));
+
+    const size_t initial_pages_capacity = 4;
+
+    *list->table = {
+        .references = 1, .version = list->version,
+        .pages = (versioned_linked_list_page<E>**)
+            calloc(initial_pages_capacity, sizeof(*list->table->pages)),
+        .number_of_pages = 0, .pages_capacity = initial_pages_capacity,
+        .used = 0
+    };
+
+    if (list->table->pages == NULL) {
+        free(list->table), list->table = NULL;
+        return FAILURE(RUNTIME_ERROR, strerror(errno));
+    }
+
+    // First page contains terminal element, that is zeroed
+    // after calloc, so it's already looped on itself
+    TRY __versioned_linked_list_add_page(list)
+        FAIL("Failed to allocate first page!");
+
+    return SUCCESS();
+}
+
+template <typename E>
+void versioned_linked_list_destroy(versioned_linked_list<E>* list) {
+    if (list != NULL && list->table != NULL) {
+        __versioned_linked_list_release_table(list->table);
+        *list = {};
+    }
+
+    // Do nothing if list is NULL (like free)
+}
+
+
+template <typename E>
+static inline
+stack_trace* __versioned_linked_list_check_index(versioned_linked_list<E>* list,
+                                                 element_index_t index) {
+    const size_t capacity =
+        list->table->number_of_pages * VERSIONED_LINKED_LIST_PAGE_SIZE;
+
+    if (index < 0 || (size_t) index >= capacity)
+        return FAILURE(RUNTIME_ERROR, "Index %d is out of list capacity %zu!",
+                       index, capacity);
+
+    if (versioned_linked_list_get_pointer(list->table, index)->is_free)
+        return FAILURE(RUNTIME_ERROR, "Element %d is free!", index);
+
+    return SUCCESS();
+}
+
+template <typename E>
+stack_trace* versioned_linked_list_insert_after(versioned_linked_list<E>* list, E value,
+                                                element_index_t prev_index,
+                                                element_index_t* actual_index = NULL) {
+
+    TRY __versioned_linked_list_check_index(list, prev_index)
+        FAIL("Illegal index passed!");
+
+    if (list->free == linked_list_end_index)
+        TRY __versioned_linked_list_add_page(list)
+            FAIL("Failed to expand list!");
+
+    const element_index_t new_index = list->free;
+
+    element<E> *new_element = NULL, *prev = NULL, *next = NULL;
+
+    TRY __versioned_linked_list_writable(list, new_index, &new_element)
+        FAIL("Failed to get free element %d for writing!", new_index);
+
+    TRY __versioned_linked_list_writable(list, prev_index, &prev)
+        FAIL("Failed to get element %d for writing!", prev_index);
+
+    const element_index_t next_index = prev->next_index;
+
+    TRY __versioned_linked_list_writable(list, next_index, &next)
+        FAIL("Failed to get element %d for writing!", next_index);
+
+    list->free = new_element->next_index;
+
+    *new_element = { .next_index = next_index, .prev_index = prev_index,
+                     .is_free = false, .element = value };
+
+    prev->next_index = next->prev_index = new_index;
+
+    if (actual_index != NULL)
+        *actual_index = new_index;
+
+    ++ list->table->used;
+
+    return SUCCESS();
+}
+
+template <typename E>
+inline stack_trace* versioned_linked_list_push_front(versioned_linked_list<E>* list, E value,
+                                                     element_index_t* actual_index = NULL) {
+    return versioned_linked_list_insert_after(list, value,
+        linked_list_end_index, actual_index);
+}
+
+template <typename E>
+inline stack_trace* versioned_linked_list_push_back(versioned_linked_list<E>* list, E value,
+                                                    element_index_t* actual_index = NULL) {
+    return versioned_linked_list_insert_after(list, value,
+        versioned_linked_list_end(list->table)->prev_index, actual_index);
+}
+
+template <typename E>
+stack_trace* versioned_linked_list_delete(versioned_linked_list<E>* list,
+                                          element_index_t index) {
+
+    TRY __versioned_linked_list_check_index(list, index)
+        FAIL("Illegal index passed!");
+
+    if (index == linked_list_end_index)
+        return FAILURE(RUNTIME_ERROR, "Terminal element can't be deleted!");
+
+    element<E> *current = NULL, *prev = NULL, *next = NULL;
+
+    TRY __versioned_linked_list_writable(list, index, &current)
+        FAIL("Failed to get element %d for writing!", index);
+
+    TRY __versioned_linked_list_writable(list, current->prev_index, &prev)
+        FAIL("Failed to get element %d for writing!", current->prev_index);
+
+    TRY __versioned_linked_list_writable(list, current->next_index, &next)
+        FAIL("Failed to get element %d for writing!", current->next_index);
+
+    prev->next_index = current->next_index;
+    next->prev_index = current->prev_index;
+
+    *current = { .next_index = list->free, .prev_index = -1,
+                 .is_free = true, .element = (E) {} };
+
+    list->free = index;
+
+    -- list->table->used;
+
+    return SUCCESS();
+}
+
+template <typename E>
+stack_trace* versioned_linked_list_set(versioned_linked_list<E>* list,
+                                       element_index_t index, E value) {
+
+    TRY __versioned_linked_list_check_index(list, index)
+        FAIL("Illegal index passed!");
+
+    element<E>* current = NULL;
+    TRY __versioned_linked_list_writable(list, index, &current)
+        FAIL("Failed to get element %d for writing!", index);
+
+    current->element = value;
+    return SUCCESS();
+}
+
+
+/**
+ * Freeze current state of the list in O(1), list's
+ * following modifications won't be visible in snapshot.
+ */
+template <typename E>
+void versioned_linked_list_take_snapshot(versioned_linked_list<E>* list,
+                                         versioned_linked_list_snapshot<E>* snapshot) {
+
+    __atomic_add_fetch(&list->table->references, 1, __ATOMIC_RELAXED);
+    snapshot->table = list->table;
+
+    // Everything that exists now belongs to snapshot as well
+    ++ list->version;
+}
+
+// Can be called from any thread
+template <typename E>
+void versioned_linked_list_snapshot_release(versioned_linked_list_snapshot<E>* snapshot) {
+    if (snapshot != NULL && snapshot->table != NULL) {
+        __versioned_linked_list_release_table(snapshot->table);
+        snapshot->table = NULL;
+    }
+}
@@ -1,5 +1,23 @@
-#define PROTECTED_STACK_USE_CANARY
-#define PROTECTED_STACK_USE_HASH
-#define PROTECTED_STACK_USE_POISON
-#define PROTECTED_STACK_USE_SALT
+// Protections of protected_stack<E>, that doesn't specify them explicitly,
+// see protected_stack_protection for the others
+#define PROTECTED_STACK_DEFAULT_PROTECTION PROTECTED_STACK_FULL_PROTECTION
 
+// Hash mode, choose one:
+//   - PROTECTED_STACK_HASH_MERKLE_TREE: tree of per-block hashes, push
+//     and pop rehash and check only path to the affected block: O(log n)
+//   - PROTECTED_STACK_HASH_FULL_BUFFER: whole buffer is rehashed
+//     on every operation: O(n)
+#define PROTECTED_STACK_HASH_MERKLE_TREE
+
+// Bytes of elements covered by one leaf of the hash tree
+#define PROTECTED_STACK_HASH_BLOCK_SIZE 256
+
+// Hash function, choose one (can be also chosen with -D at compile time):
+//   - PROTECTED_STACK_HASH_SHA_256: cryptographic, slowest one
+//   - PROTECTED_STACK_HASH_CRC32C:  32 bit, in hardware with SSE4.2
+//   - PROTECTED_STACK_HASH_XXH64:   64 bit, fast in software
+#if !defined(PROTECTED_STACK_HASH_SHA_256) && \
+    !defined(PROTECTED_STACK_HASH_CRC32C)  && \
+    !defined(PROTECTED_STACK_HASH_XXH64)
+    #define PROTECTED_STACK_HASH_SHA_256
+#endif
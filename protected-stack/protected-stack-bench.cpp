@@ -0,0 +1,102 @@
+#include "simple-stack.h"
+#include "protected-stack.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// Hash function is chosen at compile time, this name is only for output
+#if defined(PROTECTED_STACK_HASH_SHA_256)
+    static const char* const HASH_NAME = "SHA-256";
+#elif defined(PROTECTED_STACK_HASH_CRC32C)
+    static const char* const HASH_NAME = "CRC32C";
+#elif defined(PROTECTED_STACK_HASH_XXH64)
+    static const char* const HASH_NAME = "XXH64";
+#endif
+
+static const size_t STACK_SIZE = 4096;
+static const size_t ROUNDS = 16;
+
+static double seconds_since(const timespec* start) {
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) (now.tv_sec - start->tv_sec) +
+           (double) (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static double bench_simple_stack(void) {
+    simple_stack<int> stack;
+    simple_stack_create(&stack);
+
+    timespec start = {};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    volatile int sink = 0; // So pops aren't optimized out
+    for (size_t round = 0; round < ROUNDS; ++ round) {
+        for (size_t i = 0; i < STACK_SIZE; ++ i)
+            simple_stack_push(&stack, (int) i);
+
+        for (size_t i = 0; i < STACK_SIZE; ++ i)
+            sink = simple_stack_pop(&stack);
+    }
+
+    (void) sink;
+
+    double elapsed = seconds_since(&start);
+    simple_stack_destruct(&stack);
+
+    return elapsed;
+}
+
+template <unsigned P>
+static double bench_protected_stack(void) {
+    protected_stack<int, P> stack = {};
+    trace_destruct(protected_stack_create(&stack));
+
+    timespec start = {};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int value = 0;
+    for (size_t round = 0; round < ROUNDS; ++ round) {
+        for (size_t i = 0; i < STACK_SIZE; ++ i)
+            trace_destruct(protected_stack_push(&stack, (int) i));
+
+        for (size_t i = 0; i < STACK_SIZE; ++ i)
+            trace_destruct(protected_stack_pop(&stack, &value));
+    }
+
+    double elapsed = seconds_since(&start);
+    protected_stack_destroy(&stack);
+
+    return elapsed;
+}
+
+static void print_result(const char* name, const double elapsed, const double simple) {
+    const double ops = 2.0 * (double) (STACK_SIZE * ROUNDS);
+
+    printf("%-20s | %14.0lf ops/sec | %8.1lfx slower\n", name,
+           ops / elapsed, elapsed / simple);
+}
+
+int main(void) {
+    printf("%zu rounds of %zu pushes and pops, protected stack hashed with %s\n\n",
+           ROUNDS, STACK_SIZE, HASH_NAME);
+
+    const double simple = bench_simple_stack();
+    print_result("simple_stack", simple, simple);
+
+    print_result("no protection",
+        bench_protected_stack<PROTECTED_STACK_NO_PROTECTION>(), simple);
+
+    print_result("canary",
+        bench_protected_stack<PROTECTED_STACK_CANARY>(), simple);
+
+    print_result("guard pages",
+        bench_protected_stack<PROTECTED_STACK_GUARD_PAGES>(), simple);
+
+    print_result("canary, hash",
+        bench_protected_stack<PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH>(), simple);
+
+    print_result("full protection",
+        bench_protected_stack<PROTECTED_STACK_FULL_PROTECTION>(), simple);
+}
@@ -1,28 +1,406 @@
 #include "protected-stack.h"
 #include "test-framework.h"
 
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 TEST(populate_stack_with_numbers) {
     protected_stack<int> stack = {};
-    protected_stack_create(&stack);
+    TRY protected_stack_create(&stack)
+        ASSERT_SUCCESS();
 
-    const size_t size = 100;
+    const int size = 10000;
 
-    for (size_t i = 0; i < size; ++ i)
-        protected_stack_push(&stack, (int) i);
+    for (int i = 0; i < size; ++ i)
+        TRY protected_stack_push(&stack, i)
+            ASSERT_SUCCESS();
+
+    TRY protected_stack_verify(&stack)
+        ASSERT_SUCCESS();
 
-    for (size_t i = size - 1; i >= 0; -- i) {
+    for (int i = size - 1; i >= 0; -- i) {
         int value = -1;
 
-        stack_trace* trace = protected_stack_pop(&stack, &value);
-        trace_print_stack_trace(stdout, trace);
+        TRY protected_stack_pop(&stack, &value)
+            ASSERT_SUCCESS();
 
-        ASSERT_EQUAL(value, (int) i);
+        ASSERT_EQUAL(value, i);
+
+        // Hash tree shrinks along with stack
+        if (i % 1000 == 0)
+            TRY protected_stack_verify(&stack)
+                ASSERT_SUCCESS();
     }
 
     protected_stack_destroy(&stack);
 }
 
-// print *stack->elements@stack->length
-// print *stack->elements@stack->next_index
+TEST(push_and_pop_in_batches) {
+    protected_stack<int> stack = {};
+    TRY protected_stack_create(&stack)
+        ASSERT_SUCCESS();
+
+    const size_t size = 10000;
+    int* values = (int*) calloc(size, sizeof(int));
+
+    for (size_t i = 0; i < size; ++ i)
+        values[i] = (int) i;
+
+    TRY protected_stack_push(&stack, -1)
+        ASSERT_SUCCESS();
+
+    TRY protected_stack_push_n(&stack, values, size)
+        ASSERT_SUCCESS();
+
+    TRY protected_stack_verify(&stack)
+        ASSERT_SUCCESS();
+
+    memset(values, 0, size * sizeof(int));
+
+    TRY protected_stack_pop_n(&stack, values + 100, size - 100)
+        ASSERT_SUCCESS();
+
+    TRY protected_stack_pop_n(&stack, values, 100)
+        ASSERT_SUCCESS();
+
+    for (size_t i = 0; i < size; ++ i)
+        ASSERT_EQUAL(values[i], (int) i);
+
+    TRY protected_stack_verify(&stack)
+        ASSERT_SUCCESS();
+
+    stack_trace* trace = protected_stack_pop_n(&stack, values, 2);
+    ASSERT_EQUAL(trace_is_success(trace), false);
+    trace_destruct(trace);
+
+    int value = 0;
+    TRY protected_stack_pop(&stack, &value)
+        ASSERT_SUCCESS();
+
+    ASSERT_EQUAL(value, -1);
+
+    free(values);
+    protected_stack_destroy(&stack);
+}
+
+TEST(detect_corrupted_element) {
+    protected_stack<int> stack = {};
+    TRY protected_stack_create(&stack)
+        ASSERT_SUCCESS();
+
+    for (int i = 0; i < 1000; ++ i)
+        TRY protected_stack_push(&stack, i)
+            ASSERT_SUCCESS();
+
+    // Far from the top, so only full verification notices it
+    stack.elements[10] = -1;
+
+    stack_trace* trace = protected_stack_verify(&stack);
+    ASSERT_EQUAL(trace_is_success(trace), false);
+    trace_destruct(trace);
+
+    stack.elements[10] = 10;
+    TRY protected_stack_verify(&stack)
+        ASSERT_SUCCESS();
+
+    // Top element is checked on every operation
+    stack.elements[999] = -1;
+
+    int value = 0;
+    trace = protected_stack_pop(&stack, &value);
+    ASSERT_EQUAL(trace_is_success(trace), false);
+    trace_destruct(trace);
+
+    protected_stack_destroy(&stack);
+}
+
+TEST(detect_corrupted_stack) {
+    protected_stack<int> stack = {};
+    TRY protected_stack_create(&stack)
+        ASSERT_SUCCESS();
+
+    TRY protected_stack_push(&stack, 42)
+        ASSERT_SUCCESS();
+
+    ++ stack.next_index;
+
+    stack_trace* trace = protected_stack_push(&stack, 43);
+    ASSERT_EQUAL(trace_is_success(trace), false);
+    trace_destruct(trace);
+
+    -- stack.next_index;
+
+    // Overflow right past the last element hits canary
+    stack.elements[stack.length] = 0;
+
+    trace = protected_stack_verify(&stack);
+    ASSERT_EQUAL(trace_is_success(trace), false);
+    trace_destruct(trace);
+
+    protected_stack_destroy(&stack);
+}
+
+TEST(mix_protection_levels) {
+    // Unused protections take no space at all
+    ASSERT_EQUAL(sizeof(protected_stack<int, PROTECTED_STACK_NO_PROTECTION>),
+                 sizeof(int*) + 2 * sizeof(size_t) + sizeof(stack_growth_policy*));
+
+    protected_stack<int, PROTECTED_STACK_NO_PROTECTION> fast = {};
+    protected_stack<int, PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH> safe = {};
+
+    TRY protected_stack_create(&fast)
+        ASSERT_SUCCESS();
+
+    TRY protected_stack_create(&safe)
+        ASSERT_SUCCESS();
+
+    for (int i = 0; i < 100; ++ i) {
+        TRY protected_stack_push(&fast, i)
+            ASSERT_SUCCESS();
+
+        TRY protected_stack_push(&safe, i)
+            ASSERT_SUCCESS();
+    }
+
+    fast.elements[0] = -1;
+    safe.elements[0] = -1;
+
+    // Only stack with hash notices
+    TRY protected_stack_verify(&fast)
+        ASSERT_SUCCESS();
+
+    stack_trace* trace = protected_stack_verify(&safe);
+    ASSERT_EQUAL(trace_is_success(trace), false);
+    trace_destruct(trace);
+
+    protected_stack_destroy(&fast);
+    protected_stack_destroy(&safe);
+}
+
+TEST(detect_corruption_with_sampled_checks) {
+    protected_stack<int> stack = {};
+    TRY protected_stack_create(&stack)
+        ASSERT_SUCCESS();
+
+    const protected_stack_verification every_tenth = {
+        .check_every = 10, .background_period_ms = 0
+    };
+
+    TRY protected_stack_set_verification(&stack, &every_tenth)
+        ASSERT_SUCCESS();
+
+    for (int i = 0; i < 100; ++ i)
+        TRY protected_stack_push(&stack, i)
+            ASSERT_SUCCESS();
+
+    stack.elements[99] = -1;
+
+    int failed_after = 0, value = 0;
+    for (; failed_after < 10; ++ failed_after) {
+        stack_trace* trace = protected_stack_peek(&stack, &value);
+
+        bool is_success = trace_is_success(trace);
+        trace_destruct(trace);
+
+        if (!is_success)
+            break;
+    }
+
+    // Top is read, so it's checked on every operation
+    ASSERT_EQUAL(failed_after, 0);
+
+    stack.elements[99] = 99;
+    protected_stack_destroy(&stack);
+}
+
+TEST(never_hash_over_corruption_between_sampled_checks) {
+    protected_stack<int> stack = {};
+    TRY protected_stack_create(&stack)
+        ASSERT_SUCCESS();
+
+    const protected_stack_verification every_tenth = {
+        .check_every = 10, .background_period_ms = 0
+    };
+
+    TRY protected_stack_set_verification(&stack, &every_tenth)
+        ASSERT_SUCCESS();
+
+    for (int i = 0; i < 100; ++ i)
+        TRY protected_stack_push(&stack, i)
+            ASSERT_SUCCESS();
+
+    // Push rehashes top's block, so it shouldn't trust it
+    stack.elements[99] = -1;
+
+    for (int i = 0; i < 30; ++ i) {
+        stack_trace* trace = protected_stack_push(&stack, i);
+        ASSERT_EQUAL(trace_is_success(trace), false);
+        trace_destruct(trace);
+    }
+
+    int value = 0;
+    stack_trace* trace = protected_stack_pop(&stack, &value);
+    ASSERT_EQUAL(trace_is_success(trace), false);
+    trace_destruct(trace);
+
+    stack.elements[99] = 99;
+
+    // Far from the top, only scheduled full verification notices it
+    stack.elements[10] = -1;
+
+    int failures = 0;
+    for (int i = 0; i < 30; ++ i) {
+        trace = protected_stack_push(&stack, i);
+
+        failures += !trace_is_success(trace);
+        trace_destruct(trace);
+    }
+
+    ASSERT_EQUAL(failures > 0, true);
+
+    // Pushes in between didn't make corrupted element part of the hash
+    trace = protected_stack_verify(&stack);
+    ASSERT_EQUAL(trace_is_success(trace), false);
+    trace_destruct(trace);
+
+    stack.elements[10] = 10;
+    TRY protected_stack_verify(&stack)
+        ASSERT_SUCCESS();
+
+    protected_stack_destroy(&stack);
+}
+
+TEST(detect_corruption_in_background) {
+    protected_stack<int> stack = {};
+    TRY protected_stack_create(&stack)
+        ASSERT_SUCCESS();
+
+    for (int i = 0; i < 1000; ++ i)
+        TRY protected_stack_push(&stack, i)
+            ASSERT_SUCCESS();
+
+    const protected_stack_verification in_background = {
+        .check_every = 0, .background_period_ms = 1
+    };
+
+    TRY protected_stack_set_verification(&stack, &in_background)
+        ASSERT_SUCCESS();
+
+    // Far from the top, operations alone would never notice it
+    pthread_mutex_lock(&stack.verifier->lock);
+    stack.elements[10] = -1;
+    pthread_mutex_unlock(&stack.verifier->lock);
+
+    bool detected = false;
+    for (int attempt = 0; attempt < 1000 && !detected; ++ attempt) {
+        usleep(1000);
+
+        int value = 0;
+        stack_trace* trace = protected_stack_peek(&stack, &value);
+
+        detected = !trace_is_success(trace);
+        trace_destruct(trace);
+    }
+
+    ASSERT_EQUAL(detected, true);
+
+    protected_stack_destroy(&stack);
+}
+
+TEST(change_verification_while_verifying_in_background) {
+    protected_stack<int> stack = {};
+    TRY protected_stack_create(&stack)
+        ASSERT_SUCCESS();
+
+    for (int i = 0; i < 1000; ++ i)
+        TRY protected_stack_push(&stack, i)
+            ASSERT_SUCCESS();
+
+    const protected_stack_verification in_background = {
+        .check_every = 0, .background_period_ms = 1
+    };
+
+    // Verification before reconfiguring races with running thread otherwise
+    for (int i = 0; i < 200; ++ i) {
+        TRY protected_stack_set_verification(&stack, &in_background)
+            ASSERT_SUCCESS();
+
+        usleep(1500); // Thread gets to verify at least once
+
+        int value = 0;
+        TRY protected_stack_peek(&stack, &value)
+            ASSERT_SUCCESS();
+    }
+
+    TRY protected_stack_verify(&stack)
+        ASSERT_SUCCESS();
+
+    protected_stack_destroy(&stack);
+}
+
+TEST(fault_on_write_past_guard_page) {
+    protected_stack<int, PROTECTED_STACK_GUARD_PAGES | PROTECTED_STACK_HASH> stack = {};
+    TRY protected_stack_create(&stack)
+        ASSERT_SUCCESS();
+
+    for (int i = 0; i < 5000; ++ i)
+        TRY protected_stack_push(&stack, i)
+            ASSERT_SUCCESS();
+
+    for (int i = 4999; i >= 1000; -- i) {
+        int value = -1;
+        TRY protected_stack_pop(&stack, &value)
+            ASSERT_SUCCESS();
+
+        ASSERT_EQUAL(value, i);
+    }
+
+    TRY protected_stack_verify(&stack)
+        ASSERT_SUCCESS();
+
+    // Overflow by one element should crash immediately, try it in a child
+    pid_t child = fork();
+    if (child == 0) {
+        signal(SIGSEGV, SIG_DFL); // Let it die without test framework's help
+        stack.elements[stack.length] = 0;
+        _exit(0);
+    }
+
+    int status = 0;
+    waitpid(child, &status, 0);
+
+    ASSERT_EQUAL(WIFEXITED(status) && WEXITSTATUS(status) == 0, false);
+
+    TRY protected_stack_destroy(&stack)
+        ASSERT_SUCCESS();
+}
+
+TEST(keep_elements_across_guard_page_remaps) {
+    // Elements don't fill whole pages, so they shift when buffer is remapped
+    struct triple { int a, b, c; };
+
+    protected_stack<triple, PROTECTED_STACK_GUARD_PAGES | PROTECTED_STACK_HASH> stack = {};
+    TRY protected_stack_create(&stack)
+        ASSERT_SUCCESS();
+
+    for (int i = 0; i < 3000; ++ i)
+        TRY protected_stack_push(&stack, { i, -i, 2 * i })
+            ASSERT_SUCCESS();
+
+    for (int i = 2999; i >= 0; -- i) {
+        triple value = {};
+        TRY protected_stack_pop(&stack, &value)
+            ASSERT_SUCCESS();
+
+        ASSERT_EQUAL(value.a == i && value.b == -i && value.c == 2 * i, true);
+    }
+
+    TRY protected_stack_verify(&stack)
+        ASSERT_SUCCESS();
+
+    TRY protected_stack_destroy(&stack)
+        ASSERT_SUCCESS();
+}
 
 TEST_MAIN()
@@ -1,5 +1,7 @@
 #include "crypto.h"
+#include "fast-hash.h"
 #include "config.h"
+#include "stack-growth-policy.h"
 
 #include <cstddef>
 #include <cstdint>
@@ -11,195 +13,703 @@
 #include <assert.h>
 #include <errno.h>
 #include <sys/random.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <type_traits>
 
 typedef uint64_t __PROTECTED_STACK_CANARY_TYPE;
 
-#define PROTECTED_STACK_USE_HASH
+#if defined(PROTECTED_STACK_HASH_MERKLE_TREE) && defined(PROTECTED_STACK_HASH_FULL_BUFFER)
+    #error "Choose either Merkle tree or full buffer hash mode, not both!"
+#endif
 
-template <typename E>
+#ifdef PROTECTED_STACK_HASH_MERKLE_TREE
+    const bool __PROTECTED_STACK_USE_HASH_TREE = true;
+#else
+    const bool __PROTECTED_STACK_USE_HASH_TREE = false;
+#endif
+
+// ------------------------- HASH BACKEND -------------------------
+#if defined(PROTECTED_STACK_HASH_SHA_256)
+    const size_t __PROTECTED_STACK_HASH_WORDS = HASH_SIZE;
+
+    inline static void __protected_stack_hash_bytes(const void* data, const size_t size,
+                                                    uint32_t hash[__PROTECTED_STACK_HASH_WORDS]) {
+        hash_with_sha_256(data, size, hash);
+    }
+#elif defined(PROTECTED_STACK_HASH_CRC32C)
+    const size_t __PROTECTED_STACK_HASH_WORDS = 1;
+
+    inline static void __protected_stack_hash_bytes(const void* data, const size_t size,
+                                                    uint32_t hash[__PROTECTED_STACK_HASH_WORDS]) {
+        hash[0] = hash_with_crc32c(data, size);
+    }
+#elif defined(PROTECTED_STACK_HASH_XXH64)
+    const size_t __PROTECTED_STACK_HASH_WORDS = sizeof(uint64_t) / sizeof(uint32_t);
+
+    inline static void __protected_stack_hash_bytes(const void* data, const size_t size,
+                                                    uint32_t hash[__PROTECTED_STACK_HASH_WORDS]) {
+        const uint64_t xxh64 = hash_with_xxh64(data, size);
+        memcpy(hash, &xxh64, sizeof(xxh64));
+    }
+#else
+    #error "Choose hash function for protected stack in config.h!"
+#endif
+
+// ------------------------- PROTECTIONS --------------------------
+
+/**
+ * Protections, that stack can use, they can be combined, e.g.
+ * protected_stack<int, PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH>.
+ * Protections, that aren't used, take neither time nor space.
+ */
+enum protected_stack_protection : unsigned {
+    PROTECTED_STACK_NO_PROTECTION   = 0,
+
+    PROTECTED_STACK_CANARY          = 1 << 0, //!< Canaries around stack and it's buffer
+    PROTECTED_STACK_HASH            = 1 << 1, //!< Hash of stack and it's elements
+    PROTECTED_STACK_POISON          = 1 << 2, //!< Fill unused memory with poison
+    PROTECTED_STACK_SALT            = 1 << 3, //!< Random salt, so hash is unpredictable
+
+    //! Buffer is surrounded by inaccessible pages, so out of bounds access
+    //! faults right away, it's free for every operation, but resize costs
+    //! few system calls: pages are moved with mremap instead of copying, only
+    //! elements not filling whole pages are shifted. Buffer canaries aren't
+    //! needed with it.
+    PROTECTED_STACK_GUARD_PAGES     = 1 << 4,
+
+    PROTECTED_STACK_FULL_PROTECTION = PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH |
+                                      PROTECTED_STACK_POISON | PROTECTED_STACK_SALT
+};
+
+constexpr bool __protected_stack_uses(const unsigned protections,
+                                      const unsigned protection) {
+    return (protections & protection) != 0;
+}
+
+constexpr bool __protected_stack_uses_buffer_canaries(const unsigned protections) {
+    return __protected_stack_uses(protections, PROTECTED_STACK_CANARY) &&
+          !__protected_stack_uses(protections, PROTECTED_STACK_GUARD_PAGES);
+}
+
+// Takes place of disabled members, so they don't take any space
+template <int member>
+struct __protected_stack_disabled {};
+
+template <bool enabled, int member, typename T>
+using __protected_stack_optional =
+    std::conditional_t<enabled, T, __protected_stack_disabled<member>>;
+
+// ------------------------- VERIFICATION -------------------------
+
+/**
+ * How often stack should fully verify itself. Every operation still checks
+ * canaries and hash of elements it reads or rehashes (only path to them in
+ * hash tree mode), so corruption is never handed out or hashed over. Full
+ * verification finds corruption anywhere else, by default it's never done.
+ *
+ * Sampling needs PROTECTED_STACK_HASH_MERKLE_TREE: in full buffer mode every
+ * operation rehashes and checks the whole buffer anyway, so it's always full.
+ */
+struct protected_stack_verification {
+    size_t check_every;            //!< Fully verify on every Nth operation, 0 never does
+    unsigned background_period_ms; //!< Also fully verify on separate thread that
+                                   //!< often, 0 disables background verification
+};
+
+const protected_stack_verification PROTECTED_STACK_CHECK_EVERY_OPERATION = {
+    .check_every = 1, .background_period_ms = 0
+};
+
+// Lives outside of stack, because it's changed without updating stack's hash
+struct __protected_stack_verifier {
+    size_t check_every, operations_left;
+
+    bool has_background_thread; //!< Changed only by stack's owner
+    unsigned background_period_ms;
+
+    pthread_t thread;
+    pthread_mutex_t lock; //!< Owner takes it for every operation, when thread exists
+    pthread_cond_t wakeup;
+    bool running;
+
+    stack_trace* corruption; //!< Found by background thread, reported by next operation
+
+    void* stack;
+    stack_trace* (*verify)(void* stack);
+};
+
+template <typename E, unsigned P = PROTECTED_STACK_DEFAULT_PROTECTION>
 struct protected_stack {
-    #ifdef PROTECTED_STACK_USE_CANARY
-    __PROTECTED_STACK_CANARY_TYPE begin_canary;
-    #endif
+    static constexpr bool uses_hash_tree =
+        __protected_stack_uses(P, PROTECTED_STACK_HASH) && __PROTECTED_STACK_USE_HASH_TREE;
 
-    #ifdef PROTECTED_STACK_USE_SALT
-    uint32_t salt;
-    #endif
+    [[no_unique_address]] __protected_stack_optional<
+        __protected_stack_uses(P, PROTECTED_STACK_CANARY), 0,
+        __PROTECTED_STACK_CANARY_TYPE> begin_canary;
 
-    #ifdef PROTECTED_STACK_USE_HASH
-    uint32_t hash[HASH_SIZE];
-    #endif
+    [[no_unique_address]] __protected_stack_optional<
+        __protected_stack_uses(P, PROTECTED_STACK_SALT), 1,
+        uint32_t> salt;
+
+    [[no_unique_address]] __protected_stack_optional<
+        __protected_stack_uses(P, PROTECTED_STACK_HASH), 2,
+        uint32_t[__PROTECTED_STACK_HASH_WORDS]> hash;
+
+    //!< Root at 1, children of i at 2i and 2i + 1
+    [[no_unique_address]] __protected_stack_optional<uses_hash_tree, 3,
+        uint32_t (*)[__PROTECTED_STACK_HASH_WORDS]> hash_tree;
+
+    //!< Always a power of two
+    [[no_unique_address]] __protected_stack_optional<uses_hash_tree, 4,
+        size_t> hash_tree_leaves;
 
     E* elements;
 
     size_t length; size_t next_index;
 
-    #ifdef PROTECTED_STACK_USE_CANARY
-    __PROTECTED_STACK_CANARY_TYPE   end_canary;
-    #endif
+    const stack_growth_policy* growth_policy;
+
+    // NULL means check on every operation
+    [[no_unique_address]] __protected_stack_optional<
+        __protected_stack_uses(P, PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH), 6,
+        __protected_stack_verifier*> verifier;
+
+    [[no_unique_address]] __protected_stack_optional<
+        __protected_stack_uses(P, PROTECTED_STACK_CANARY), 5,
+        __PROTECTED_STACK_CANARY_TYPE> end_canary;
 };
 
 // --------------------------- CANARIES ---------------------------
-static const __PROTECTED_STACK_CANARY_TYPE __PROTECTED_STACK_CANARY_MASK =
-    (__PROTECTED_STACK_CANARY_TYPE) 0xDED32'6DE'BEEF'F00D;
+static const __PROTECTED_STACK_CANARY_TYPE __PROTECTED_STACK_CANARY_MASK = 0xDED32'6DE'BEEF'F00D;
 
-template <typename T>
+template <typename E, unsigned P>
 inline static __PROTECTED_STACK_CANARY_TYPE
-__protected_stack_calculate_canary(protected_stack<T>* stack) {
+__protected_stack_calculate_canary(protected_stack<E, P>* stack) {
     return (uintptr_t) stack ^ __PROTECTED_STACK_CANARY_MASK;
 }
 
-template <typename T>
-inline static void __protected_stack_init_canary(protected_stack<T>* stack) {
-    __PROTECTED_STACK_CANARY_TYPE canary =
-        __protected_stack_calculate_canary(stack); 
+template <typename E, unsigned P>
+inline static void __protected_stack_init_canary(protected_stack<E, P>* stack) {
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_CANARY)) {
+        __PROTECTED_STACK_CANARY_TYPE canary =
+            __protected_stack_calculate_canary(stack);
 
-    stack->begin_canary = stack->end_canary = canary;
+        stack->begin_canary = stack->end_canary = canary;
+    }
 }
 
-#ifdef PROTECTED_STACK_USE_CANARY
-    #define __PROTECTED_STACK_INIT_CANARY(stack) \
-        __protected_stack_init_canary(stack)
-#else
-    #define __PROTECTED_STACK_INIT_CANARY(stack) \
-        ((void) 0)
-#endif
-
 // ---------------------------- POISON ----------------------------
 static const char __PROTECTED_STACK_POISON = (char) 0xFE;
 
-template <typename E>
-inline static void __protected_stack_poison_struct(protected_stack<E>* stack) {
-    memset(stack, __PROTECTED_STACK_POISON, sizeof(stack));
+template <typename E, unsigned P>
+inline static void __protected_stack_poison_struct(protected_stack<E, P>* stack) {
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_POISON))
+        memset((void*) stack, __PROTECTED_STACK_POISON, sizeof(*stack));
 }
 
+template <unsigned P>
 inline static void __protected_stack_poison_array(void* array,
                                                   size_t old_size,
                                                   size_t new_size) {
-    if (new_size > old_size && array != NULL) {
-        size_t diff = new_size - old_size;
-        void* start_ptr = ((char*) array) + old_size;
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_POISON))
+        if (new_size > old_size && array != NULL) {
+            size_t diff = new_size - old_size;
+            void* start_ptr = ((char*) array) + old_size;
+
+            memset(start_ptr, __PROTECTED_STACK_POISON, diff);
+        }
+}
+
+template <typename E, unsigned P>
+inline static void __protected_stack_clear_hash(protected_stack<E, P>* stack) {
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_POISON))
+        memset(stack->hash, __PROTECTED_STACK_POISON, sizeof(stack->hash));
+    else
+        memset(stack->hash, 0, sizeof(stack->hash));
+}
+
+// ----------------------------- HASH -----------------------------
+template <typename E, unsigned P>
+inline static stack_trace* __protected_stack_init_salt(protected_stack<E, P>* stack) {
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_SALT))
+        if (getrandom(&stack->salt, sizeof(stack->salt), 0) == -1)
+            return FAILURE(RUNTIME_ERROR, strerror(errno));
+
+    return SUCCESS();
+}
+
+// Leaves of hash tree are hashes of consecutive blocks of used part of
+// the buffer, every other node is a hash of it's two children. Changing
+// one element requires rehashing it's block and path to the root only.
+
+// Leaves past the top and nodes above them are all zeros, so tree can
+// be resized along with buffer without rehashing anything.
+
+inline static bool __protected_stack_hash_is_empty(const uint32_t hash[__PROTECTED_STACK_HASH_WORDS]) {
+    for (size_t i = 0; i < __PROTECTED_STACK_HASH_WORDS; ++ i)
+        if (hash[i] != 0)
+            return false;
+
+    return true;
+}
+
+inline static bool __protected_stack_hash_equal(const uint32_t first[__PROTECTED_STACK_HASH_WORDS],
+                                                const uint32_t second[__PROTECTED_STACK_HASH_WORDS]) {
+    return memcmp(first, second, __PROTECTED_STACK_HASH_WORDS * sizeof(uint32_t)) == 0;
+}
 
-        memset(array, __PROTECTED_STACK_POISON, diff);
+template <typename E, unsigned P>
+inline static void __protected_stack_hash_leaf(protected_stack<E, P>* stack,
+                                               const size_t leaf,
+                                               uint32_t hash[__PROTECTED_STACK_HASH_WORDS]) {
+    const size_t used_size   = stack->next_index * sizeof(E),
+                 block_start = leaf * PROTECTED_STACK_HASH_BLOCK_SIZE;
+
+    if (block_start >= used_size) {
+        memset(hash, 0, __PROTECTED_STACK_HASH_WORDS * sizeof(uint32_t));
+        return;
     }
+
+    const size_t block_size = used_size - block_start < PROTECTED_STACK_HASH_BLOCK_SIZE ?
+        used_size - block_start : PROTECTED_STACK_HASH_BLOCK_SIZE;
+
+    __protected_stack_hash_bytes((char*) stack->elements + block_start, block_size, hash);
 }
 
-#ifdef PROTECTED_STACK_USE_POISON
-    #define __PROTECTED_STACK_POISON_STRUCT(stack)                \
-        __protected_stack_poison_struct(stack)
+template <typename E, unsigned P>
+inline static void __protected_stack_hash_children(protected_stack<E, P>* stack,
+                                                   const size_t node,
+                                                   uint32_t hash[__PROTECTED_STACK_HASH_WORDS]) {
+    if (__protected_stack_hash_is_empty(stack->hash_tree[2 * node    ]) &&
+        __protected_stack_hash_is_empty(stack->hash_tree[2 * node + 1])) {
+        memset(hash, 0, __PROTECTED_STACK_HASH_WORDS * sizeof(uint32_t));
+        return;
+    }
 
-#define __PROTECTED_STACK_POISON_ARRAY(array, old_size, new_size) \
-        __protected_stack_poison_array(array, old_size, new_size)
-#else
-    #define __PROTECTED_STACK_POISON_STRUCT(stack)                \
-        ((void) 0)
+    // Children are adjacent, so they're hashed in one go
+    __protected_stack_hash_bytes(stack->hash_tree[2 * node],
+                                 2 * sizeof(*stack->hash_tree), hash);
+}
 
-    #define __PROTECTED_STACK_POISON_ARRAY(array, size)           \
-        ((void) 0)
-#endif
+/**
+ * Make tree cover current length of the buffer. Every level of the tree
+ * is shifted to become left part of the same level in a deeper tree, or
+ * the other way around, used leaves stay in the left part of the tree.
+ */
+template <typename E, unsigned P>
+inline static stack_trace* __protected_stack_resize_hash_tree(protected_stack<E, P>* stack) {
+    typedef uint32_t (*hash_tree_t)[__PROTECTED_STACK_HASH_WORDS];
+    const size_t node_size = sizeof(*stack->hash_tree);
+
+    size_t leaves = 1;
+    while (leaves * PROTECTED_STACK_HASH_BLOCK_SIZE < stack->length * sizeof(E))
+        leaves *= 2;
+
+    const size_t old_leaves = stack->hash_tree_leaves;
+
+    if (stack->hash_tree == NULL) {
+        // Tree for empty stack is all zeros
+        stack->hash_tree = (hash_tree_t) calloc(2 * leaves, node_size);
+        if (stack->hash_tree == NULL)
+            return FAILURE(RUNTIME_ERROR, strerror(errno));
+
+    } else if (leaves > old_leaves) {
+        void* new_tree = realloc(stack->hash_tree, 2 * leaves * node_size);
+        if (new_tree == NULL)
+            return FAILURE(RUNTIME_ERROR, strerror(errno));
+
+        stack->hash_tree = (hash_tree_t) new_tree;
+
+        const size_t scale = leaves / old_leaves;
+
+        // Deepest levels first, so they're moved before shallower ones overwrite them
+        for (size_t level = old_leaves; level >= 1; level /= 2) {
+            memmove(stack->hash_tree[level * scale], stack->hash_tree[level],
+                    level * node_size);
+
+            memset(stack->hash_tree[level * scale + level], 0,
+                   (level * scale - level) * node_size);
+        }
+
+        // Old root is now the leftmost node on level with scale nodes
+        memset(stack->hash_tree[1], 0, (scale - 1) * node_size);
+        for (size_t node = scale / 2; node >= 1; node /= 2)
+            __protected_stack_hash_children(stack, node, stack->hash_tree[node]);
+
+    } else if (leaves < old_leaves) {
+        const size_t scale = old_leaves / leaves;
+
+        for (size_t level = 1; level <= leaves; level *= 2)
+            memmove(stack->hash_tree[level], stack->hash_tree[level * scale],
+                    level * node_size);
+
+        void* new_tree = realloc(stack->hash_tree, 2 * leaves * node_size);
+        if (new_tree == NULL)
+            return FAILURE(RUNTIME_ERROR, strerror(errno));
 
+        stack->hash_tree = (hash_tree_t) new_tree;
+    }
+
+    stack->hash_tree_leaves = leaves;
+    return SUCCESS();
+}
+
+// Element can span several blocks, if it's size isn't a divisor of block size
 template <typename E>
-inline static void __protected_stack_clear_hash(protected_stack<E>* stack) {
-    memset(stack->hash, 0, HASH_SIZE);
+inline static size_t __protected_stack_first_leaf(const size_t index) {
+    return index * sizeof(E) / PROTECTED_STACK_HASH_BLOCK_SIZE;
 }
 
 template <typename E>
-inline static void __protected_stack_poison_hash(protected_stack<E>* stack) {
-    memset(stack->hash, __PROTECTED_STACK_POISON, HASH_SIZE);
+inline static size_t __protected_stack_last_leaf(const size_t index) {
+    return ((index + 1) * sizeof(E) - 1) / PROTECTED_STACK_HASH_BLOCK_SIZE;
 }
 
-#ifdef PROTECTED_STACK_USE_POISON
-    #define __PROTECTED_STACK_CLEAR_HASH(stack)         \
-        __protected_stack_poison_hash(stack)
-#else
-    #define __PROTECTED_STACK_CLEAR_HASH(stack)         \
-        __protected_stack_clear_hash(stack)
-#endif
+/**
+ * Rehash leaves covering elements in [first, last), and then every node
+ * above them, level by level, so shared ancestors are hashed only once.
+ */
+template <typename E, unsigned P>
+inline static void __protected_stack_update_hash_paths(protected_stack<E, P>* stack,
+                                                       const size_t first, const size_t last) {
+    if (first >= last)
+        return;
 
-// ----------------------------- HASH -----------------------------
-template <typename E>
-inline static stack_trace* __protected_stack_init_salt(protected_stack<E>* stack) {
-    if (getrandom(&stack->salt, sizeof(stack->salt), 0) == -1)
-        return FAILURE(RUNTIME_ERROR, strerror(errno));
+    const size_t leaves = stack->hash_tree_leaves;
 
-    return SUCCESS();
+    size_t low  = leaves + __protected_stack_first_leaf<E>(first),
+           high = leaves + __protected_stack_last_leaf<E>(last - 1);
+
+    for (size_t leaf = low; leaf <= high; ++ leaf)
+        __protected_stack_hash_leaf(stack, leaf - leaves, stack->hash_tree[leaf]);
+
+    while (low > 1) {
+        low /= 2, high /= 2;
+
+        for (size_t node = low; node <= high; ++ node)
+            __protected_stack_hash_children(stack, node, stack->hash_tree[node]);
+    }
 }
 
-#ifdef PROTECTED_STACK_USE_SALT
-    #define __PROTECTED_STACK_INIT_SALT(stack) \
-        __protected_stack_init_salt(stack);
-#else
-    #define __PROTECTED_STACK_INIT_SALT(stack) \
-        (void) 0
-#endif
+template <typename E, unsigned P>
+inline static bool __protected_stack_test_hash_paths(protected_stack<E, P>* stack,
+                                                     const size_t first, const size_t last) {
+    if (first >= last)
+        return true;
 
-template <typename E>
-inline static void __protected_stack_calculate_hash(protected_stack<E>* stack,
-                                                    uint32_t hash[HASH_SIZE]) {
+    const size_t leaves = stack->hash_tree_leaves;
+    uint32_t actual_hash[__PROTECTED_STACK_HASH_WORDS];
+
+    size_t low  = leaves + __protected_stack_first_leaf<E>(first),
+           high = leaves + __protected_stack_last_leaf<E>(last - 1);
+
+    for (size_t leaf = low; leaf <= high; ++ leaf) {
+        __protected_stack_hash_leaf(stack, leaf - leaves, actual_hash);
+        if (!__protected_stack_hash_equal(actual_hash, stack->hash_tree[leaf]))
+            return false;
+    }
+
+    while (low > 1) {
+        low /= 2, high /= 2;
+
+        for (size_t node = low; node <= high; ++ node) {
+            __protected_stack_hash_children(stack, node, actual_hash);
+            if (!__protected_stack_hash_equal(actual_hash, stack->hash_tree[node]))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+template <typename E, unsigned P>
+inline static bool __protected_stack_test_hash_tree(protected_stack<E, P>* stack) {
+    const size_t leaves = stack->hash_tree_leaves;
+    uint32_t actual_hash[__PROTECTED_STACK_HASH_WORDS];
+
+    for (size_t leaf = 0; leaf < leaves; ++ leaf) {
+        __protected_stack_hash_leaf(stack, leaf, actual_hash);
+        if (!__protected_stack_hash_equal(actual_hash, stack->hash_tree[leaves + leaf]))
+            return false;
+    }
+
+    for (size_t node = leaves - 1; node >= 1; -- node) {
+        __protected_stack_hash_children(stack, node, actual_hash);
+        if (!__protected_stack_hash_equal(actual_hash, stack->hash_tree[node]))
+            return false;
+    }
+
+    return true;
+}
+
+template <typename E, unsigned P>
+inline static void __protected_stack_calculate_buffer_hash(protected_stack<E, P>* stack,
+                                                           uint32_t hash[__PROTECTED_STACK_HASH_WORDS]) {
+    if constexpr (protected_stack<E, P>::uses_hash_tree)
+        memcpy(hash, stack->hash_tree[1], sizeof(*stack->hash_tree));
+    else
+        __protected_stack_hash_bytes(stack->elements, sizeof(E) * stack->next_index, hash);
+}
+
+template <typename E, unsigned P>
+inline static void __protected_stack_calculate_hash(protected_stack<E, P>* stack,
+                                                    uint32_t hash[__PROTECTED_STACK_HASH_WORDS]) {
     // Old hash should be zeroed out before this function
 
-    uint32_t stack_hash[HASH_SIZE];
-    hash_with_sha_256(stack, sizeof(stack), stack_hash);
+    uint32_t stack_hash[__PROTECTED_STACK_HASH_WORDS];
+    __protected_stack_hash_bytes(stack, sizeof(*stack), stack_hash);
 
-    hash_with_sha_256(stack->elements,
-        sizeof(E) * stack->length, hash);
+    __protected_stack_calculate_buffer_hash(stack, hash);
 
-    for (size_t i = 0; i < HASH_SIZE; ++ i)
+    for (size_t i = 0; i < __PROTECTED_STACK_HASH_WORDS; ++ i)
         hash[i] ^= stack_hash[i];
 }
 
-template <typename E>
-inline static void __protected_stack_update_hash(protected_stack<E>* stack) {
-    __PROTECTED_STACK_CLEAR_HASH(stack);
-    __protected_stack_calculate_hash(stack, stack->hash);
+// Stack itself changed, but buffer didn't
+template <typename E, unsigned P>
+inline static void __protected_stack_update_hash(protected_stack<E, P>* stack) {
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_HASH)) {
+        __protected_stack_clear_hash(stack);
+        __protected_stack_calculate_hash(stack, stack->hash);
+    }
 }
 
-template <typename E>
-inline static bool __protected_stack_test_hash(protected_stack<E>* stack) {
-    uint32_t stored_hash[HASH_SIZE];
+// Elements in [first, last) changed
+template <typename E, unsigned P>
+inline static void __protected_stack_update_range_hash(protected_stack<E, P>* stack,
+                                                       const size_t first, const size_t last) {
+    if constexpr (protected_stack<E, P>::uses_hash_tree)
+        __protected_stack_update_hash_paths(stack, first, last);
+
+    // Otherwise whole buffer is going to be rehashed anyway
+    __protected_stack_update_hash(stack);
+}
+
+// Element with index changed
+template <typename E, unsigned P>
+inline static void __protected_stack_update_element_hash(protected_stack<E, P>* stack,
+                                                         const size_t index) {
+    __protected_stack_update_range_hash(stack, index, index + 1);
+}
+
+// Buffer was reallocated, but it's used part stayed the same
+template <typename E, unsigned P>
+inline static stack_trace* __protected_stack_resize_hash(protected_stack<E, P>* stack) {
+    if constexpr (protected_stack<E, P>::uses_hash_tree)
+        TRY __protected_stack_resize_hash_tree(stack)
+            FAIL("Hash tree resizing failed!");
+
+    __protected_stack_update_hash(stack);
+    return SUCCESS();
+}
+
+template <typename E, unsigned P>
+inline static bool __protected_stack_test_hash(protected_stack<E, P>* stack) {
+    uint32_t stored_hash[__PROTECTED_STACK_HASH_WORDS];
 
     // Save hash from stack
-    memcpy(stored_hash, stack->hash, HASH_SIZE);
+    memcpy(stored_hash, stack->hash, sizeof(stored_hash));
 
     // Clear it before recalculation
-    __PROTECTED_STACK_CLEAR_HASH(stack);
+    __protected_stack_clear_hash(stack);
 
-    uint32_t actual_hash[HASH_SIZE];
+    uint32_t actual_hash[__PROTECTED_STACK_HASH_WORDS];
     __protected_stack_calculate_hash(stack, actual_hash);
 
     // Restore hash
-    memcpy(stack->hash, stored_hash, HASH_SIZE);
+    memcpy(stack->hash, stored_hash, sizeof(stored_hash));
 
-    for (size_t i = 0; i < HASH_SIZE; ++ i)
+    for (size_t i = 0; i < __PROTECTED_STACK_HASH_WORDS; ++ i)
         if (stored_hash[i] != actual_hash[i])
             return false;
 
     return true;
 }
 
-#ifdef PROTECTED_STACK_USE_HASH
-    #define INIT_HASH(stack) __protected_stack_update_hash()
-#else
-    #define INIT_HASH(stack) __protected_stack_update_hash()
-#endif
+// Checks stack itself and every element
+template <typename E, unsigned P>
+inline static bool __protected_stack_test_full_hash(protected_stack<E, P>* stack) {
+    if constexpr (!__protected_stack_uses(P, PROTECTED_STACK_HASH))
+        return true;
+    else {
+        if constexpr (protected_stack<E, P>::uses_hash_tree)
+            if (!__protected_stack_test_hash_tree(stack))
+                return false;
+
+        return __protected_stack_test_hash(stack);
+    }
+}
+
+// Checks stack itself and elements in [first, last), cheaper with hash tree
+template <typename E, unsigned P>
+inline static bool __protected_stack_test_range_hash(protected_stack<E, P>* stack,
+                                                     const size_t first, const size_t last) {
+    if constexpr (!__protected_stack_uses(P, PROTECTED_STACK_HASH))
+        return true;
+    else {
+        // Otherwise whole buffer is going to be checked anyway
+        if constexpr (protected_stack<E, P>::uses_hash_tree)
+            if (!__protected_stack_test_hash_paths(stack, first, last))
+                return false;
+
+        return __protected_stack_test_hash(stack);
+    }
+}
 
+template <typename E, unsigned P>
+inline static void __protected_stack_destroy_hash(protected_stack<E, P>* stack) {
+    if constexpr (protected_stack<E, P>::uses_hash_tree) {
+        free(stack->hash_tree), stack->hash_tree = NULL;
+        stack->hash_tree_leaves = 0;
+    }
+}
+
+// ---------------------------- BUFFER ----------------------------
 inline static size_t align_index(size_t index, size_t alignment) {
-    return index + alignment - index % alignment;
+    return (index + alignment - 1) / alignment * alignment;
 }
 
-template <typename E> inline static stack_trace*
-__protected_stack_resize_array(protected_stack<E>* stack, const size_t nmemb) {
+// Buffer is [canary] [elements] [canary], canaries are there only if they're used
+template <typename E, unsigned P>
+inline static size_t __protected_stack_first_element_byte(void) {
+    if constexpr (!__protected_stack_uses_buffer_canaries(P))
+        return 0;
+
     // Align first array element (in case canary has unaligned size)
-    size_t first_element_byte = align_index(
-        sizeof(__PROTECTED_STACK_CANARY_TYPE), sizeof(E));
+    return align_index(sizeof(__PROTECTED_STACK_CANARY_TYPE), sizeof(E));
+}
 
-    // Align second canary
-    size_t second_canary_byte = align_index(
-        first_element_byte + nmemb * sizeof(E),
+template <typename E, unsigned P>
+inline static size_t __protected_stack_second_canary_byte(const size_t nmemb) {
+    return align_index(
+        __protected_stack_first_element_byte<E, P>() + nmemb * sizeof(E),
         sizeof(__PROTECTED_STACK_CANARY_TYPE));
+}
+
+// ------------------------- GUARD PAGES --------------------------
+
+// Mapping is [guard page] [pages with elements] [guard page], elements
+// end right before the second guard page, so even overflow by one byte
+// faults. Underflow faults only after it passes first page with elements.
+
+inline static size_t __protected_stack_page_size(void) {
+    static const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+template <typename E>
+inline static size_t __protected_stack_mapped_elements_size(const size_t nmemb) {
+    return align_index(nmemb * sizeof(E), __protected_stack_page_size());
+}
 
-    const size_t elements_buffer_size = second_canary_byte +
-        sizeof(__PROTECTED_STACK_CANARY_TYPE);
+template <typename E, unsigned P>
+inline static char* __protected_stack_mapping_start(protected_stack<E, P>* stack) {
+    return (char*) (stack->elements + stack->length)
+        - __protected_stack_mapped_elements_size<E>(stack->length)
+        - __protected_stack_page_size();
+}
+
+template <typename E>
+inline static size_t __protected_stack_mapping_size(const size_t nmemb) {
+    return __protected_stack_mapped_elements_size<E>(nmemb) + 2 * __protected_stack_page_size();
+}
+
+template <typename E, unsigned P> inline static stack_trace*
+__protected_stack_remap_array(protected_stack<E, P>* stack, const size_t nmemb) {
+    const size_t page_size = __protected_stack_page_size(),
+                 elements_size = __protected_stack_mapped_elements_size<E>(nmemb),
+                 mapping_size = __protected_stack_mapping_size<E>(nmemb),
+                 old_elements_size = __protected_stack_mapped_elements_size<E>(stack->length),
+                 old_mapping_size = __protected_stack_mapping_size<E>(stack->length),
+                 kept = (stack->length < nmemb ? stack->length : nmemb) * sizeof(E);
+
+    char* const old_mapping = stack->elements == NULL ? NULL : __protected_stack_mapping_start(stack);
+    char* mapping = old_mapping;
+
+    // Elements end right before second guard page, so they shift inside
+    // mapping only when padding before them changes (never for page multiples)
+    const size_t offset = page_size + elements_size - nmemb * sizeof(E);
+
+    if (old_mapping != NULL && elements_size <= old_elements_size) {
+        char* const guard_page = mapping + page_size + elements_size;
+
+        // Kept elements can reach into new guard page, then they leave it first
+        const bool moves_down = mapping + offset < (char*) stack->elements;
+        if (moves_down)
+            memmove(mapping + offset, stack->elements, kept);
+
+        if (elements_size < old_elements_size) {
+            if (mprotect(guard_page, page_size, PROT_NONE) == -1) {
+                stack_trace* trace = FAILURE(RUNTIME_ERROR, strerror(errno));
+                if (moves_down)
+                    memmove(stack->elements, mapping + offset, kept);
+
+                return trace;
+            }
+
+            // Pages past new guard page, including old one, aren't needed
+            munmap(guard_page + page_size, old_mapping_size - mapping_size);
+        }
+
+        if (!moves_down)
+            memmove(mapping + offset, stack->elements, kept);
+
+    } else {
+        // New guard pages are reserved first, then accessible pages move
+        // between them without copying and grow with zeroed pages
+        mapping = (char*) mmap(NULL, mapping_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+            return FAILURE(RUNTIME_ERROR, strerror(errno));
+
+        const bool mapped = old_elements_size == 0
+            ? mprotect(mapping + page_size, elements_size, PROT_READ | PROT_WRITE) != -1
+            : mremap(old_mapping + page_size, old_elements_size, elements_size,
+                     MREMAP_MAYMOVE | MREMAP_FIXED, mapping + page_size) != MAP_FAILED;
+
+        if (!mapped) {
+            stack_trace* trace = FAILURE(RUNTIME_ERROR, strerror(errno));
+            munmap(mapping, mapping_size);
+            return trace;
+        }
+
+        if (old_mapping != NULL) {
+            memmove(mapping + offset, mapping + ((char*) stack->elements - old_mapping), kept);
+
+            // Only old guard pages are left there
+            munmap(old_mapping, old_mapping_size);
+        }
+    }
+
+    E* new_space = (E*) (mapping + offset);
+
+    stack->elements = new_space;
+
+    if (nmemb > stack->length)
+        __protected_stack_poison_array<P>(new_space, stack->length * sizeof(E),
+                                          nmemb * sizeof(E));
+
+    stack->length = nmemb;
+
+    TRY __protected_stack_resize_hash(stack)
+        FAIL("Rehashing resized stack failed!");
+
+    return SUCCESS();
+}
+
+template <typename E, unsigned P> inline static stack_trace*
+__protected_stack_resize_array(protected_stack<E, P>* stack, const size_t nmemb) {
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_GUARD_PAGES))
+        return __protected_stack_remap_array(stack, nmemb);
+
+    const size_t first_element_byte = __protected_stack_first_element_byte<E, P>();
+
+    size_t elements_buffer_size = first_element_byte + nmemb * sizeof(E);
+    if constexpr (__protected_stack_uses_buffer_canaries(P))
+        elements_buffer_size = __protected_stack_second_canary_byte<E, P>(nmemb) +
+            sizeof(__PROTECTED_STACK_CANARY_TYPE);
 
     E* new_space = NULL;
 
@@ -219,15 +729,17 @@ __protected_stack_resize_array(protected_stack<E>* stack, const size_t nmemb) {
 
     // Completly disregard calloc's work. I'm sad (c) Calloc
     if (nmemb > stack->length)
-        __PROTECTED_STACK_POISON_ARRAY(new_space, stack->length * sizeof(E) + first_element_byte,
-                                    (nmemb - stack->length) * sizeof(E) + first_element_byte);
+        __protected_stack_poison_array<P>((char*) new_space + first_element_byte,
+                                          stack->length * sizeof(E), nmemb * sizeof(E));
 
-    __PROTECTED_STACK_CANARY_TYPE
-        * first_canary = (__PROTECTED_STACK_CANARY_TYPE*) stack->elements,
-        *second_canary = (__PROTECTED_STACK_CANARY_TYPE*)
-            ((char*) stack->elements + second_canary_byte);
+    if constexpr (__protected_stack_uses_buffer_canaries(P)) {
+        __PROTECTED_STACK_CANARY_TYPE
+            * first_canary = (__PROTECTED_STACK_CANARY_TYPE*) stack->elements,
+            *second_canary = (__PROTECTED_STACK_CANARY_TYPE*)
+                ((char*) stack->elements + __protected_stack_second_canary_byte<E, P>(nmemb));
 
-    *first_canary = *second_canary = __protected_stack_calculate_canary(stack);
+        *first_canary = *second_canary = __protected_stack_calculate_canary(stack);
+    }
 
     // We could use initializer: { ... }, but it could've zeroed struct's
     // alignment (in case there's some), which was filled with poison previously
@@ -236,89 +748,508 @@ __protected_stack_resize_array(protected_stack<E>* stack, const size_t nmemb) {
     // Move pointer to elements past first canary
     stack->elements = (E*) ((char*) stack->elements + first_element_byte);
 
-    printf("(%d, %d, %d)\n", stack->next_index, first_element_byte, (uintptr_t) stack->elements);
-    printf("[\n");
-    for (int i = 0; i < stack->next_index; ++ i)
-        printf("    %x\n", stack->elements[i]);
+    TRY __protected_stack_resize_hash(stack)
+        FAIL("Rehashing resized stack failed!");
+
+    return SUCCESS();
+}
+
+// ------------------------- VERIFICATION -------------------------
+template <typename E, unsigned P>
+inline static bool __protected_stack_test_canaries(protected_stack<E, P>* stack) {
+    if constexpr (!__protected_stack_uses(P, PROTECTED_STACK_CANARY))
+        return true;
+    else {
+        const __PROTECTED_STACK_CANARY_TYPE canary =
+            __protected_stack_calculate_canary(stack);
+
+        if (stack->begin_canary != canary || stack->end_canary != canary)
+            return false;
 
-    for (int i = stack->next_index; i < stack->length; ++ i)
-        printf("   (%x)\n", stack->elements[i]);
-    printf("]\n");
+        if constexpr (!__protected_stack_uses_buffer_canaries(P))
+            return true; // Buffer is protected by guard pages
+
+        char* buffer = (char*) stack->elements - __protected_stack_first_element_byte<E, P>();
+        const size_t second_canary_byte =
+            __protected_stack_second_canary_byte<E, P>(stack->length);
+
+        return *(__PROTECTED_STACK_CANARY_TYPE*)  buffer                       == canary &&
+               *(__PROTECTED_STACK_CANARY_TYPE*) (buffer + second_canary_byte) == canary;
+    }
+}
+
+/**
+ * Check that stack is intact before touching it: canaries, and hash of the
+ * stack with elements in [first, last) (whole buffer in full buffer mode).
+ */
+template <typename E, unsigned P>
+inline static stack_trace* __protected_stack_check(protected_stack<E, P>* stack,
+                                                   const size_t first, const size_t last) {
+    if (stack == NULL || stack->elements == NULL)
+        return FAILURE(LOGIC_ERROR, "Stack isn't initialized!");
+
+    if (!__protected_stack_test_canaries(stack))
+        return FAILURE(LOGIC_ERROR, "Stack's canaries are corrupted!");
+
+    if (!__protected_stack_test_range_hash(stack, first, last))
+        return FAILURE(LOGIC_ERROR, "Stack's hash doesn't match, it's corrupted!");
 
     return SUCCESS();
 }
 
-template <typename E>
-stack_trace* protected_stack_destroy(protected_stack<E>* stack) {
-    size_t first_element_byte = align_index(
-        sizeof(__PROTECTED_STACK_CANARY_TYPE), sizeof(E));
+template <typename E, unsigned P>
+inline static stack_trace* __protected_stack_verify(protected_stack<E, P>* stack) {
+    if (stack == NULL || stack->elements == NULL)
+        return FAILURE(LOGIC_ERROR, "Stack isn't initialized!");
+
+    if (!__protected_stack_test_canaries(stack))
+        return FAILURE(LOGIC_ERROR, "Stack's canaries are corrupted!");
+
+    if (!__protected_stack_test_full_hash(stack))
+        return FAILURE(LOGIC_ERROR, "Stack's hash doesn't match, it's corrupted!");
+
+    return SUCCESS();
+}
+
+// For background thread, that doesn't know stack's type
+template <typename E, unsigned P>
+inline static stack_trace* __protected_stack_verify_erased(void* stack) {
+    return __protected_stack_verify((protected_stack<E, P>*) stack);
+}
+
+template <typename E, unsigned P>
+inline static bool __protected_stack_has_background_thread(protected_stack<E, P>* stack) {
+    if constexpr (!__protected_stack_uses(P, PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH))
+        return false;
+    else
+        return stack->verifier != NULL && stack->verifier->has_background_thread;
+}
+
+// Operations are serialized with background thread only when it exists
+template <typename E, unsigned P>
+inline static void __protected_stack_lock(protected_stack<E, P>* stack) {
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH))
+        if (__protected_stack_has_background_thread(stack))
+            pthread_mutex_lock(&stack->verifier->lock);
+}
+
+template <typename E, unsigned P>
+inline static void __protected_stack_unlock(protected_stack<E, P>* stack) {
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH))
+        if (__protected_stack_has_background_thread(stack))
+            pthread_mutex_unlock(&stack->verifier->lock);
+}
+
+/**
+ * Check elements in [first, last), which operation is going to read or
+ * rehash, and the whole stack, if it's scheduled. Also reports corruption,
+ * that background thread found since last operation.
+ */
+template <typename E, unsigned P>
+inline static stack_trace* __protected_stack_scheduled_check(protected_stack<E, P>* stack,
+                                                             const size_t first,
+                                                             const size_t last) {
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH)) {
+        if (stack == NULL || stack->elements == NULL)
+            return FAILURE(LOGIC_ERROR, "Stack isn't initialized!");
+
+        __protected_stack_verifier* verifier = stack->verifier;
+
+        if (verifier != NULL) {
+            if (verifier->corruption != NULL) {
+                stack_trace* corruption = verifier->corruption;
+                verifier->corruption = NULL;
+
+                return PASS_FAILURE(corruption, LOGIC_ERROR,
+                                    "Background verification found corruption!");
+            }
+
+            if (verifier->check_every != 0 && -- verifier->operations_left == 0) {
+                verifier->operations_left = verifier->check_every;
+                return __protected_stack_verify(stack);
+            }
+        }
+    }
+
+    // Skipping this would let corruption become part of the hash
+    return __protected_stack_check(stack, first, last);
+}
+
+inline static void* __protected_stack_background_verification(void* raw_verifier) {
+    __protected_stack_verifier* verifier = (__protected_stack_verifier*) raw_verifier;
+
+    pthread_mutex_lock(&verifier->lock);
+
+    while (verifier->running) {
+        timespec deadline = {};
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        const long NANOSECONDS_IN_SECOND = 1000000000L;
+
+        deadline.tv_nsec += (long) verifier->background_period_ms % 1000 * 1000000L;
+        deadline.tv_sec  += verifier->background_period_ms / 1000 +
+                            deadline.tv_nsec / NANOSECONDS_IN_SECOND;
+        deadline.tv_nsec %= NANOSECONDS_IN_SECOND;
+
+        // Owner can work with stack while this thread sleeps
+        pthread_cond_timedwait(&verifier->wakeup, &verifier->lock, &deadline);
+
+        if (verifier->running && verifier->corruption == NULL) {
+            stack_trace* trace = verifier->verify(verifier->stack);
+
+            if (trace_is_success(trace))
+                trace_destruct(trace);
+            else
+                verifier->corruption = trace;
+        }
+    }
+
+    pthread_mutex_unlock(&verifier->lock);
+    return NULL;
+}
+
+inline static void __protected_stack_stop_background_verification(
+        __protected_stack_verifier* verifier) {
+
+    if (verifier == NULL || !verifier->has_background_thread)
+        return;
+
+    pthread_mutex_lock(&verifier->lock);
+    verifier->running = false;
+    pthread_cond_signal(&verifier->wakeup);
+    pthread_mutex_unlock(&verifier->lock);
+
+    pthread_join(verifier->thread, NULL);
+    verifier->has_background_thread = false;
+}
+
+template <typename E, unsigned P>
+inline static void __protected_stack_destroy_verifier(protected_stack<E, P>* stack) {
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH)) {
+        __protected_stack_verifier* verifier = stack->verifier;
+        if (verifier == NULL)
+            return;
+
+        __protected_stack_stop_background_verification(verifier);
+
+        pthread_mutex_destroy(&verifier->lock);
+        pthread_cond_destroy(&verifier->wakeup);
+
+        if (verifier->corruption != NULL)
+            trace_destruct(verifier->corruption);
+
+        free(verifier), stack->verifier = NULL;
+    }
+}
+
+/**
+ * Check every protection of the stack, including hash of every element.
+ */
+template <typename E, unsigned P>
+stack_trace* protected_stack_verify(protected_stack<E, P>* stack) {
+    __protected_stack_lock(stack);
+    stack_trace* trace = __protected_stack_verify(stack);
+    __protected_stack_unlock(stack);
+
+    return trace;
+}
+
+/**
+ * Change how often stack checks itself, see #protected_stack_verification.
+ * Stack shouldn't be moved, while it's verified in background.
+ */
+template <typename E, unsigned P>
+stack_trace* protected_stack_set_verification(protected_stack<E, P>* stack,
+                                              const protected_stack_verification* verification) {
+    static_assert(__protected_stack_uses(P, PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH),
+                  "Stack without canaries and hash has nothing to verify!");
+
+    static_assert(!__protected_stack_uses(P, PROTECTED_STACK_HASH) ||
+                  protected_stack<E, P>::uses_hash_tree,
+                  "Full buffer hash is checked whole on every operation, nothing to sample!");
+
+    // Background thread could be verifying right now, it swaps hash out meanwhile
+    __protected_stack_lock(stack);
+    stack_trace* trace = __protected_stack_verify(stack);
+    __protected_stack_unlock(stack);
+
+    if (!trace_is_success(trace))
+        return PASS_FAILURE(trace, RUNTIME_ERROR, "Stack is corrupted already!");
+
+    trace_destruct(trace);
+
+    __protected_stack_verifier* verifier = stack->verifier;
+
+    if (verifier == NULL) {
+        verifier = (__protected_stack_verifier*) calloc(1, sizeof(*verifier));
+        if (verifier == NULL)
+            return FAILURE(RUNTIME_ERROR, strerror(errno));
+
+        pthread_mutex_init(&verifier->lock, NULL);
+        pthread_cond_init(&verifier->wakeup, NULL);
+
+        stack->verifier = verifier;
+        __protected_stack_update_hash(stack);
+    } else
+        __protected_stack_stop_background_verification(verifier);
+
+    verifier->check_every = verifier->operations_left = verification->check_every;
+    verifier->background_period_ms = verification->background_period_ms;
+
+    if (verification->background_period_ms > 0) {
+        verifier->stack  = stack;
+        verifier->verify = &__protected_stack_verify_erased<E, P>;
+
+        verifier->running = true;
+
+        int error = pthread_create(&verifier->thread, NULL,
+                                   &__protected_stack_background_verification, verifier);
+        if (error != 0)
+            return FAILURE(RUNTIME_ERROR, strerror(error));
+
+        verifier->has_background_thread = true;
+    }
+
+    return SUCCESS();
+}
+
+template <typename E, unsigned P>
+stack_trace* protected_stack_destroy(protected_stack<E, P>* stack) {
+    __protected_stack_destroy_verifier(stack);
+
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_GUARD_PAGES)) {
+        if (munmap(__protected_stack_mapping_start(stack),
+                   __protected_stack_mapping_size<E>(stack->length)) == -1)
+            return FAILURE(RUNTIME_ERROR, strerror(errno));
 
-    free((char*) stack->elements - first_element_byte),
         stack->elements = NULL;
+    } else
+        free((char*) stack->elements - __protected_stack_first_element_byte<E, P>()),
+            stack->elements = NULL;
+
+    __protected_stack_destroy_hash(stack);
+
+    return SUCCESS();
 }
 
-static const double GROW = 2.0;
-static const double INIT_NMEMB = 10;
+template <typename T, unsigned P>
+stack_trace* protected_stack_create(protected_stack<T, P>* stack,
+                                    const stack_growth_policy* growth_policy =
+                                        &STACK_DEFAULT_GROWTH_POLICY) {
+    __protected_stack_poison_struct(stack);
+
+    // Poison is fine for padding, but not for these
+    stack->elements = NULL;
+    stack->length = stack->next_index = 0;
+
+    if constexpr (protected_stack<T, P>::uses_hash_tree) {
+        stack->hash_tree = NULL;
+        stack->hash_tree_leaves = 0;
+    }
+
+    if constexpr (__protected_stack_uses(P, PROTECTED_STACK_CANARY | PROTECTED_STACK_HASH))
+        stack->verifier = NULL;
+
+    stack->growth_policy = growth_policy;
 
-template <typename T>
-stack_trace* protected_stack_create(protected_stack<T>* stack) {
-    __PROTECTED_STACK_POISON_STRUCT(stack);
+    __protected_stack_init_canary(stack);
 
-    stack_trace* salt_trace = __PROTECTED_STACK_INIT_SALT(stack);
+    stack_trace* salt_trace = __protected_stack_init_salt(stack);
     if (!trace_is_success(salt_trace))
         return PASS_FAILURE(salt_trace, RUNTIME_ERROR, "Salt initialization failed!");
 
-    stack_trace* resize_trace = __protected_stack_resize_array(stack, INIT_NMEMB);
+    stack_trace* resize_trace = __protected_stack_resize_array(stack,
+        stack_growth_policy_initial_capacity(growth_policy));
     if (!trace_is_success(resize_trace))
         return PASS_FAILURE(resize_trace, RUNTIME_ERROR, "Array creating failed!");
 
-    __PROTECTED_STACK_INIT_CANARY(stack);
-
     return SUCCESS();
 }
 
-template <typename T>
-stack_trace* protected_stack_push(protected_stack<T>* stack, const T value) {
+/**
+ * Pushed elements are rehashed together with leaves they share with the
+ * top, so these leaves are checked from the top up to the last pushed
+ * element, that fits in current buffer.
+ */
+template <typename T, unsigned P>
+inline static stack_trace* __protected_stack_check_before_push(protected_stack<T, P>* stack,
+                                                               const size_t count) {
+    const size_t first = stack->next_index > 0 ? stack->next_index - 1 : 0,
+                 last  = stack->next_index + count < stack->length ?
+                         stack->next_index + count : stack->length;
+
+    return __protected_stack_scheduled_check(stack, first, last);
+}
+
+template <typename T, unsigned P>
+inline static stack_trace* __protected_stack_push(protected_stack<T, P>* stack, const T value) {
+    TRY __protected_stack_check_before_push(stack, 1)
+        FAIL("Pushing to corrupted stack!");
+
     if (stack->length == stack->next_index) {
-        stack_trace* trace = 
-            __protected_stack_resize_array(stack, stack->length * GROW);
+        stack_trace* trace = __protected_stack_resize_array(stack,
+            stack_growth_policy_grow(stack->growth_policy, stack->length));
 
         if (!trace_is_success(trace))
             return PASS_FAILURE(trace, RUNTIME_ERROR, "Stack expanding failed!");
     }
 
     stack->elements[stack->next_index ++] = value;
+    __protected_stack_update_element_hash(stack, stack->next_index - 1);
+
     return SUCCESS();
 }
 
-template <typename T>
-stack_trace* protected_stack_pop(protected_stack<T>* stack, T* const value) {
-    const size_t shrinked_size = stack->length / GROW;
+template <typename T, unsigned P>
+inline static stack_trace* __protected_stack_pop(protected_stack<T, P>* stack, T* const value) {
+    if (stack->next_index == 0)
+        return FAILURE(RUNTIME_ERROR, "Popping failed because stack is empty!");
 
-    if (stack->next_index - 1 < shrinked_size && shrinked_size >= INIT_NMEMB) {
-        setvbuf(stdout, NULL, _IONBF, 0);
+    TRY __protected_stack_scheduled_check(stack, stack->next_index - 1, stack->next_index)
+        FAIL("Popping from corrupted stack!");
 
-        stack_trace* trace = 
+    *value = stack->elements[-- stack->next_index];
+
+    // Popped element isn't covered by hash anymore
+    __protected_stack_update_element_hash(stack, stack->next_index);
+
+    const size_t shrinked_size = stack_growth_policy_shrink(stack->growth_policy,
+                                                            stack->next_index,
+                                                            stack->length);
+    if (shrinked_size < stack->length) {
+        stack_trace* trace =
             __protected_stack_resize_array(stack, shrinked_size);
 
         if (!trace_is_success(trace))
             return PASS_FAILURE(trace, RUNTIME_ERROR, "Stack shrinking failed!");
     }
 
-    *value = stack->elements[-- stack->next_index];
     return SUCCESS();
 }
 
-template <typename T>
-stack_trace* protected_stack_peek(protected_stack<T>* stack, T* const value) {
+template <typename T, unsigned P>
+inline static stack_trace* __protected_stack_peek(protected_stack<T, P>* stack, T* const value) {
     if (stack->next_index <= 0)
         return FAILURE(RUNTIME_ERROR, "Top element peeking failed because stack is empty!");
 
+    TRY __protected_stack_scheduled_check(stack, stack->next_index - 1, stack->next_index)
+        FAIL("Peeking into corrupted stack!");
+
     *value = stack->elements[stack->next_index - 1];
     return SUCCESS();
 }
 
-template <typename T>
-bool protected_stack_empty(protected_stack<T>* stack) {
+template <typename T, unsigned P>
+inline static stack_trace* __protected_stack_push_n(protected_stack<T, P>* stack,
+                                                    const T* const values, const size_t count) {
+    TRY __protected_stack_check_before_push(stack, count)
+        FAIL("Pushing to corrupted stack!");
+
+    size_t new_length = stack->length;
+    while (new_length < stack->next_index + count)
+        new_length = stack_growth_policy_grow(stack->growth_policy, new_length);
+
+    if (new_length > stack->length) {
+        stack_trace* trace = __protected_stack_resize_array(stack, new_length);
+
+        if (!trace_is_success(trace))
+            return PASS_FAILURE(trace, RUNTIME_ERROR, "Stack expanding failed!");
+    }
+
+    memcpy((void*) (stack->elements + stack->next_index), values, count * sizeof(T));
+    stack->next_index += count;
+
+    __protected_stack_update_range_hash(stack, stack->next_index - count, stack->next_index);
+    return SUCCESS();
+}
+
+template <typename T, unsigned P>
+inline static stack_trace* __protected_stack_pop_n(protected_stack<T, P>* stack,
+                                                   T* const values, const size_t count) {
+    if (stack->next_index < count)
+        return FAILURE(RUNTIME_ERROR, "Popping failed because stack has too few elements!");
+
+    // Every popped element is checked, as if they were popped one by one
+    TRY __protected_stack_scheduled_check(stack, stack->next_index - count, stack->next_index)
+        FAIL("Popping from corrupted stack!");
+
+    stack->next_index -= count;
+    memcpy((void*) values, stack->elements + stack->next_index, count * sizeof(T));
+
+    // Popped elements aren't covered by hash anymore
+    __protected_stack_update_range_hash(stack, stack->next_index, stack->next_index + count);
+
+    size_t new_length = stack->length, shrinked_length = 0;
+    while ((shrinked_length = stack_growth_policy_shrink(stack->growth_policy,
+                                stack->next_index, new_length)) < new_length)
+        new_length = shrinked_length;
+
+    if (new_length < stack->length) {
+        stack_trace* trace = __protected_stack_resize_array(stack, new_length);
+
+        if (!trace_is_success(trace))
+            return PASS_FAILURE(trace, RUNTIME_ERROR, "Stack shrinking failed!");
+    }
+
+    return SUCCESS();
+}
+
+template <typename T, unsigned P>
+stack_trace* protected_stack_push(protected_stack<T, P>* stack, const T value) {
+    __protected_stack_lock(stack);
+    stack_trace* trace = __protected_stack_push(stack, value);
+    __protected_stack_unlock(stack);
+
+    return trace;
+}
+
+template <typename T, unsigned P>
+stack_trace* protected_stack_pop(protected_stack<T, P>* stack, T* const value) {
+    __protected_stack_lock(stack);
+    stack_trace* trace = __protected_stack_pop(stack, value);
+    __protected_stack_unlock(stack);
+
+    return trace;
+}
+
+template <typename T, unsigned P>
+stack_trace* protected_stack_peek(protected_stack<T, P>* stack, T* const value) {
+    __protected_stack_lock(stack);
+    stack_trace* trace = __protected_stack_peek(stack, value);
+    __protected_stack_unlock(stack);
+
+    return trace;
+}
+
+/**
+ * Push count values at once: stack is checked, reallocated
+ * and rehashed only once for the whole batch.
+ */
+template <typename T, unsigned P>
+stack_trace* protected_stack_push_n(protected_stack<T, P>* stack,
+                                    const T* const values, const size_t count) {
+    __protected_stack_lock(stack);
+    stack_trace* trace = __protected_stack_push_n(stack, values, count);
+    __protected_stack_unlock(stack);
+
+    return trace;
+}
+
+/**
+ * Pop count values at once, they keep order they had in
+ * stack (so values[count - 1] is the former top).
+ */
+template <typename T, unsigned P>
+stack_trace* protected_stack_pop_n(protected_stack<T, P>* stack,
+                                   T* const values, const size_t count) {
+    __protected_stack_lock(stack);
+    stack_trace* trace = __protected_stack_pop_n(stack, values, count);
+    __protected_stack_unlock(stack);
+
+    return trace;
+}
+
+template <typename T, unsigned P>
+bool protected_stack_empty(protected_stack<T, P>* stack) {
     return stack->next_index == 0;
 }
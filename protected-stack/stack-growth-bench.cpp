@@ -0,0 +1,104 @@
+#include "simple-stack.h"
+#include "protected-stack.h"
+#include "stack-growth-policy.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// Policy stacks used before: shrink as soon as stack is half empty
+static const stack_growth_policy EAGER_SHRINK_GROWTH_POLICY = {
+    .grow_factor = 2.0, .shrink_occupancy = 0.5,
+    .min_capacity = 10, .never_shrink = false
+};
+
+struct named_policy {
+    const char* name;
+    const stack_growth_policy* policy;
+};
+
+static const named_policy POLICIES[] = {
+    { "eager shrink (1/2)",   &EAGER_SHRINK_GROWTH_POLICY       },
+    { "hysteresis (1/4)",     &STACK_DEFAULT_GROWTH_POLICY      },
+    { "never shrink",         &STACK_NEVER_SHRINK_GROWTH_POLICY },
+};
+
+// Capacity boundary, that stacks will oscillate around (10 * 2^14)
+static const size_t BOUNDARY = 163840;
+
+static const size_t ITERATIONS = 20000;
+
+static double seconds_since(const timespec* start) {
+    timespec now = {};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double) (now.tv_sec - start->tv_sec) +
+           (double) (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static double bench_simple_stack(const stack_growth_policy* policy) {
+    simple_stack<int> stack;
+    simple_stack_create(&stack, policy);
+
+    for (size_t i = 0; i < BOUNDARY - 1; ++ i)
+        simple_stack_push(&stack, (int) i);
+
+    timespec start = {};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Cross boundary back and forth: BOUNDARY - 1 <=> BOUNDARY + 1
+    for (size_t i = 0; i < ITERATIONS; ++ i) {
+        simple_stack_push(&stack, 1);
+        simple_stack_push(&stack, 2);
+
+        simple_stack_pop(&stack);
+        simple_stack_pop(&stack);
+    }
+
+    double elapsed = seconds_since(&start);
+    simple_stack_destruct(&stack);
+
+    return elapsed;
+}
+
+static double bench_protected_stack(const stack_growth_policy* policy) {
+    protected_stack<int> stack = {};
+    trace_destruct(protected_stack_create(&stack, policy));
+
+    for (size_t i = 0; i < BOUNDARY - 1; ++ i)
+        trace_destruct(protected_stack_push(&stack, (int) i));
+
+    timespec start = {};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int value = 0;
+    for (size_t i = 0; i < ITERATIONS; ++ i) {
+        trace_destruct(protected_stack_push(&stack, 1));
+        trace_destruct(protected_stack_push(&stack, 2));
+
+        trace_destruct(protected_stack_pop(&stack, &value));
+        trace_destruct(protected_stack_pop(&stack, &value));
+    }
+
+    double elapsed = seconds_since(&start);
+    protected_stack_destroy(&stack);
+
+    return elapsed;
+}
+
+int main(void) {
+    printf("%zu push/push/pop/pop cycles around capacity of %zu elements\n\n",
+           ITERATIONS, BOUNDARY);
+
+    printf("%-20s | %-19s | %-19s\n", "policy", "simple_stack", "protected_stack");
+    printf("---------------------+---------------------+--------------------\n");
+
+    for (size_t i = 0; i < sizeof(POLICIES) / sizeof(*POLICIES); ++ i) {
+        const double simple    = bench_simple_stack   (POLICIES[i].policy),
+                     protected_ = bench_protected_stack(POLICIES[i].policy);
+
+        const double ops = 4.0 * (double) ITERATIONS;
+
+        printf("%-20s | %8.2lf ns/op      | %8.2lf ns/op\n", POLICIES[i].name,
+               simple * 1e9 / ops, protected_ * 1e9 / ops);
+    }
+}
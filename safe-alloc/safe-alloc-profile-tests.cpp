@@ -0,0 +1,123 @@
+#include "safe-alloc.h"
+#include "test-framework.h"
+
+#ifndef SAFE_ALLOC_PROFILE
+#error "Profile tests need SAFE_ALLOC_PROFILE defined"
+#endif
+
+// Statistics of site on given line of this file, zeroed if it wasn't profiled
+static safe_alloc_site find_site(const int line) {
+    safe_alloc_site sites[64] = {};
+    const size_t count = safe_alloc_profile_sites(sites, 64);
+
+    for (size_t i = 0; i < count && i < 64; ++ i)
+        if (sites[i].allocated_at.line == line && strcmp(sites[i].allocated_at.file, __FILE__) == 0)
+            return sites[i];
+
+    return {};
+}
+
+TEST(count_allocations_and_frees) {
+    int* blocks[3] = {};
+
+    const int line = __LINE__ + 2;
+    for (int i = 0; i < 3; ++ i)
+        TRY safe_calloc(10, &blocks[i])
+            ASSERT_SUCCESS();
+
+    safe_alloc_site site = find_site(line);
+
+    ASSERT_EQUAL((int) site.allocations, 3);
+    ASSERT_EQUAL((int) site.reallocations, 0);
+    ASSERT_EQUAL((int) site.total_bytes, 30 * (int) sizeof(int));
+    ASSERT_EQUAL((int) site.live_bytes,  30 * (int) sizeof(int));
+
+    safe_free(blocks[0]);
+    ASSERT_EQUAL((int) find_site(line).live_bytes, 20 * (int) sizeof(int));
+
+    safe_free(blocks[1]), safe_free(blocks[2]);
+
+    site = find_site(line);
+    ASSERT_EQUAL((int) site.live_bytes, 0);
+    ASSERT_EQUAL((int) site.peak_live_bytes, 30 * (int) sizeof(int));
+}
+
+TEST(attribute_realloc_chain_to_first_allocation) {
+    int* block = NULL;
+
+    const int calloc_line = __LINE__ + 1;
+    TRY safe_calloc(1, &block)
+        ASSERT_SUCCESS();
+
+    // Growing moves block (every time under sanitizer), so it's found
+    // only by the pointer realloc was given
+    const int realloc_line = __LINE__ + 2;
+    for (size_t size = 2; size <= 1024; size *= 2)
+        TRY safe_realloc(&block, size)
+            ASSERT_SUCCESS();
+
+    safe_alloc_site site = find_site(calloc_line);
+
+    ASSERT_EQUAL((int) site.allocations, 1);
+    ASSERT_EQUAL((int) site.reallocations, 10);
+    ASSERT_EQUAL((int) site.longest_realloc_chain, 10);
+    ASSERT_EQUAL((int) site.live_bytes, 1024 * (int) sizeof(int));
+    ASSERT_EQUAL((int) site.total_bytes, 1024 * (int) sizeof(int));
+
+    // Reallocations never became allocations of their own
+    ASSERT_EQUAL((int) find_site(realloc_line).allocations, 0);
+
+    safe_free(block);
+    ASSERT_EQUAL((int) find_site(calloc_line).live_bytes, 0);
+}
+
+TEST(realloc_from_null_is_allocation) {
+    long* block = NULL;
+
+    const int line = __LINE__ + 1;
+    TRY safe_realloc(&block, 16)
+        ASSERT_SUCCESS();
+
+    // Shrinking keeps total, but lowers live bytes
+    TRY safe_realloc(&block, 4)
+        ASSERT_SUCCESS();
+
+    const safe_alloc_site site = find_site(line);
+
+    ASSERT_EQUAL((int) site.allocations, 1);
+    ASSERT_EQUAL((int) site.reallocations, 1);
+    ASSERT_EQUAL((int) site.total_bytes, 16 * (int) sizeof(long));
+    ASSERT_EQUAL((int) site.live_bytes,   4 * (int) sizeof(long));
+    ASSERT_EQUAL((int) site.peak_live_bytes, 16 * (int) sizeof(long));
+
+    safe_free(block);
+}
+
+TEST(account_buffer_resizes_to_creating_site) {
+    // Crosses threshold, so heap and mapped buffers are both accounted
+    const safe_buffer_policy policy = { .mmap_threshold = 4096, .huge_pages = false };
+
+    int* buffer = NULL;
+
+    const int line = __LINE__ + 1;
+    TRY safe_buffer_resize(&buffer, 0, 16, &policy)
+        ASSERT_SUCCESS();
+
+    size_t size = 16;
+    for (; size < 64 * 1024; size *= 2)
+        TRY safe_buffer_resize(&buffer, size, 2 * size, &policy)
+            ASSERT_SUCCESS();
+
+    safe_alloc_site site = find_site(line);
+
+    ASSERT_EQUAL((int) site.allocations, 1);
+    ASSERT_EQUAL((int) site.reallocations, 12);
+    ASSERT_EQUAL((int) site.live_bytes, (int) (size * sizeof(int)));
+
+    safe_buffer_free(buffer, size, &policy);
+    ASSERT_EQUAL((int) find_site(line).live_bytes, 0);
+}
+
+int main(void) {
+    return test_framework_run_all_unit_tests();
+}
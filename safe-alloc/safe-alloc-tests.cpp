@@ -0,0 +1,250 @@
+#include "safe-alloc.h"
+#include "test-framework.h"
+
+#include <pthread.h>
+
+static int count_chunks(safe_arena* arena) {
+    int chunks = 0;
+    for (safe_arena_chunk* chunk = arena->first; chunk != NULL; chunk = chunk->next)
+        ++ chunks;
+
+    return chunks;
+}
+
+TEST(arena_aligns_every_type) {
+    safe_arena arena = {};
+    TRY safe_arena_create(&arena, 256)
+        ASSERT_SUCCESS();
+
+    // Odd sizes in between, so next start always needs aligning
+    for (int i = 0; i < 100; ++ i) {
+        char* bytes = NULL;
+        TRY safe_arena_alloc(&arena, (size_t) i % 7 + 1, &bytes)
+            ASSERT_SUCCESS();
+
+        double* number = NULL;
+        TRY safe_arena_alloc(&arena, 1, &number)
+            ASSERT_SUCCESS();
+
+        max_align_t* widest = NULL;
+        TRY safe_arena_alloc(&arena, 1, &widest)
+            ASSERT_SUCCESS();
+
+        ASSERT_EQUAL((int) ((uintptr_t) number % alignof(double)), 0);
+        ASSERT_EQUAL((int) ((uintptr_t) widest % alignof(max_align_t)), 0);
+    }
+
+    safe_arena_destroy(&arena);
+}
+
+TEST(arena_grows_chunks_geometrically) {
+    safe_arena arena = {};
+    TRY safe_arena_create(&arena, 64)
+        ASSERT_SUCCESS();
+
+    // Doesn't fit in the first chunk, next one is twice as big
+    char* space = NULL;
+    TRY safe_arena_alloc(&arena, 100, &space)
+        ASSERT_SUCCESS();
+
+    ASSERT_EQUAL(count_chunks(&arena), 2);
+    ASSERT_EQUAL((int) arena.current->size, 128);
+    ASSERT_EQUAL(space == arena.current->data, true);
+
+    // Bigger than double, chunk is grown until it fits
+    TRY safe_arena_alloc(&arena, 1000, &space)
+        ASSERT_SUCCESS();
+
+    ASSERT_EQUAL(count_chunks(&arena), 3);
+    ASSERT_EQUAL((int) arena.current->size, 1024);
+
+    for (int i = 0; i < 1000; ++ i)
+        ASSERT_EQUAL((int) space[i], 0);
+
+    safe_arena_destroy(&arena);
+}
+
+TEST(arena_reuses_chunks_after_reset) {
+    safe_arena arena = {};
+    TRY safe_arena_create(&arena, 64)
+        ASSERT_SUCCESS();
+
+    char* first_pass[20] = {};
+    for (int i = 0; i < 20; ++ i) {
+        TRY safe_arena_alloc(&arena, 40, &first_pass[i])
+            ASSERT_SUCCESS();
+
+        memset(first_pass[i], 0xFF, 40);
+    }
+
+    const int chunks = count_chunks(&arena);
+    ASSERT_EQUAL(chunks > 2, true);
+
+    safe_arena_reset(&arena);
+
+    // Only the first chunk is cleared, rest wait until allocation reaches them
+    ASSERT_EQUAL(arena.first->used == 0 && arena.first->next->used > 0, true);
+
+    // Same allocations land in the same places, dirty chunks are
+    // cleared as they're reached, so memory is zeroed again
+    for (int i = 0; i < 20; ++ i) {
+        char* space = NULL;
+        TRY safe_arena_alloc(&arena, 40, &space)
+            ASSERT_SUCCESS();
+
+        ASSERT_EQUAL(space == first_pass[i], true);
+
+        for (int j = 0; j < 40; ++ j)
+            ASSERT_EQUAL((int) space[j], 0);
+    }
+
+    ASSERT_EQUAL(count_chunks(&arena), chunks);
+
+    safe_arena_destroy(&arena);
+}
+
+TEST(destroy_arena) {
+    safe_arena arena = {};
+    TRY safe_arena_create(&arena, 64)
+        ASSERT_SUCCESS();
+
+    max_align_t* space = NULL;
+    for (int i = 0; i < 50; ++ i)
+        TRY safe_arena_alloc(&arena, 3, &space)
+            ASSERT_SUCCESS();
+
+    safe_arena_reset(&arena);
+
+    // Chunks kept after reset are freed too, sanitizer reports leaks
+    safe_arena_destroy(&arena);
+
+    ASSERT_EQUAL(arena.first == NULL && arena.current == NULL, true);
+}
+
+TEST(alternate_between_pools) {
+    // More pools than every thread keeps caches for
+    const size_t number_of_pools = OBJECT_POOL_THREAD_CACHES + 2;
+    object_pool<long> pools[number_of_pools] = {};
+
+    for (size_t i = 0; i < number_of_pools; ++ i)
+        TRY object_pool_create(&pools[i])
+            ASSERT_SUCCESS();
+
+    for (int iteration = 0; iteration < 10000; ++ iteration) {
+        long* first = NULL, *second = NULL;
+
+        // Two pools at a time, like two trees built side by side
+        object_pool<long>* pool = &pools[(size_t) iteration / 100 % number_of_pools];
+        object_pool<long>* other_pool = &pools[(size_t) iteration % 2];
+
+        TRY object_pool_alloc(pool, &first)
+            ASSERT_SUCCESS();
+
+        TRY object_pool_alloc(other_pool, &second)
+            ASSERT_SUCCESS();
+
+        *first = *second = iteration;
+
+        object_pool_free(pool, first);
+        object_pool_free(other_pool, second);
+    }
+
+    // Objects freed to one pool aren't lost, when thread switches to another
+    for (size_t i = 0; i < number_of_pools; ++ i) {
+        ASSERT_EQUAL(count_chunks(&pools[i].slabs), 1);
+        object_pool_destroy(&pools[i]);
+    }
+}
+
+const size_t NUMBER_OF_THREADS = 4;
+const size_t OBJECTS_PER_THREAD = 1000;
+
+struct free_from_thread_args {
+    object_pool<long>* pool;
+    long** objects;
+};
+
+static void* free_from_thread(void* raw_args) {
+    free_from_thread_args* args = (free_from_thread_args*) raw_args;
+
+    object_pool<long> own_pool = {};
+    object_pool_create(&own_pool);
+
+    for (size_t i = 0; i < OBJECTS_PER_THREAD; ++ i) {
+        long* own_object = NULL;
+        object_pool_alloc(&own_pool, &own_object);
+
+        object_pool_free(args->pool, args->objects[i]);
+        object_pool_free(&own_pool, own_object);
+    }
+
+    object_pool_destroy(&own_pool);
+    return NULL;
+}
+
+TEST(free_from_several_threads) {
+    object_pool<long> pool = {};
+    TRY object_pool_create(&pool)
+        ASSERT_SUCCESS();
+
+    const size_t number_of_objects = NUMBER_OF_THREADS * OBJECTS_PER_THREAD;
+    long** objects = (long**) calloc(number_of_objects, sizeof(*objects));
+
+    for (size_t i = 0; i < number_of_objects; ++ i) {
+        TRY object_pool_alloc(&pool, &objects[i])
+            ASSERT_SUCCESS();
+
+        ASSERT_EQUAL((int) *objects[i], 0);
+        *objects[i] = (long) i;
+    }
+
+    const int chunks = count_chunks(&pool.slabs);
+
+    pthread_t threads[NUMBER_OF_THREADS] = {};
+    free_from_thread_args args[NUMBER_OF_THREADS] = {};
+
+    for (size_t i = 0; i < NUMBER_OF_THREADS; ++ i) {
+        args[i] = { .pool = &pool, .objects = objects + i * OBJECTS_PER_THREAD };
+        pthread_create(&threads[i], NULL, free_from_thread, &args[i]);
+    }
+
+    for (size_t i = 0; i < NUMBER_OF_THREADS; ++ i)
+        pthread_join(threads[i], NULL);
+
+    // Exited threads gave their caches back, so everything is reused
+    for (size_t i = 0; i < number_of_objects; ++ i)
+        TRY object_pool_alloc(&pool, &objects[i])
+            ASSERT_SUCCESS();
+
+    ASSERT_EQUAL(count_chunks(&pool.slabs), chunks);
+
+    free(objects);
+    object_pool_destroy(&pool);
+}
+
+TEST(release_pool_with_cached_objects) {
+    object_pool<long> pool = {};
+    TRY object_pool_create(&pool, 4)
+        ASSERT_SUCCESS();
+
+    long* object = NULL;
+    for (int i = 0; i < 100; ++ i)
+        TRY object_pool_alloc(&pool, &object)
+            ASSERT_SUCCESS();
+
+    object_pool_free(&pool, object);
+    object_pool_release(&pool);
+
+    // Cached object is stale now, it's carved again from the first slab
+    long* first = NULL;
+    TRY object_pool_alloc(&pool, &first)
+        ASSERT_SUCCESS();
+
+    ASSERT_EQUAL((char*) first == pool.slabs.first->data, true);
+
+    object_pool_destroy(&pool);
+}
+
+int main(void) {
+    return test_framework_run_all_unit_tests();
+}
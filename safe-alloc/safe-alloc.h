@@ -1,42 +1,909 @@
 #pragma once
 
+#include <errno.h>
 #include <malloc.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <string.h>
 
 #include "trace.h"
 
+// --------------------------- PROFILE ----------------------------
+
+#ifdef SAFE_ALLOC_PROFILE
+
+/**
+ * Statistics for one place in code, where #safe_calloc or #safe_realloc
+ * allocated new block. Reallocations are accounted to the site, that
+ * allocated block first, so growing containers show up as one site.
+ */
+struct safe_alloc_site {
+    occurance allocated_at;
+
+    size_t allocations;
+    size_t reallocations;
+    size_t longest_realloc_chain; //!< Most reallocations of a single block
+
+    size_t total_bytes;           //!< Requested in allocations and growths
+    size_t live_bytes;
+    size_t peak_live_bytes;
+};
+
+struct __safe_alloc_block {
+    void* pointer;
+    size_t size;
+
+    size_t site;
+    size_t realloc_chain;
+};
+
+// Marks removed block, so probing continues past it
+inline char __safe_alloc_tombstone;
+#define __SAFE_ALLOC_TOMBSTONE ((void*) &__safe_alloc_tombstone)
+
+struct __safe_alloc_profile {
+    pthread_mutex_t lock;
+
+    safe_alloc_site* sites;
+    size_t sites_count, sites_capacity;
+
+    __safe_alloc_block* blocks; //!< Open addressing table, keyed by pointer
+    size_t blocks_used, blocks_capacity;
+};
+
+inline __safe_alloc_profile __safe_alloc_global_profile = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+inline size_t __safe_alloc_find_site(__safe_alloc_profile* profile, occurance at) {
+    for (size_t i = 0; i < profile->sites_count; ++ i) {
+        const occurance site = profile->sites[i].allocated_at;
+
+        // Same header can be included in different translation units
+        if (site.line == at.line && (site.file == at.file || strcmp(site.file, at.file) == 0))
+            return i;
+    }
+
+    if (profile->sites_count == profile->sites_capacity) {
+        const size_t new_capacity = profile->sites_capacity == 0 ? 16 : 2 * profile->sites_capacity;
+
+        void* new_sites = realloc(profile->sites, new_capacity * sizeof(*profile->sites));
+        if (new_sites == NULL)
+            abort(); // Profiling can't continue without it
+
+        profile->sites = (safe_alloc_site*) new_sites;
+        profile->sites_capacity = new_capacity;
+    }
+
+    profile->sites[profile->sites_count] = { .allocated_at = at };
+    return profile->sites_count ++;
+}
+
+inline size_t __safe_alloc_block_slot(__safe_alloc_profile* profile, void* pointer) {
+    return (size_t) (((uintptr_t) pointer >> 4) * 0x9E3779B97F4A7C15ull)
+                   & (profile->blocks_capacity - 1);
+}
+
+inline __safe_alloc_block* __safe_alloc_find_block(__safe_alloc_profile* profile, void* pointer) {
+    if (profile->blocks_capacity == 0)
+        return NULL;
+
+    for (size_t slot = __safe_alloc_block_slot(profile, pointer);
+         profile->blocks[slot].pointer != NULL;
+         slot = (slot + 1) & (profile->blocks_capacity - 1))
+
+        if (profile->blocks[slot].pointer == pointer)
+            return &profile->blocks[slot];
+
+    return NULL;
+}
+
+inline void __safe_alloc_insert_block(__safe_alloc_profile* profile, __safe_alloc_block block);
+
+// Rebuild table without tombstones, growing it if it's too full
+inline void __safe_alloc_rehash_blocks(__safe_alloc_profile* profile) {
+    __safe_alloc_block* old_blocks = profile->blocks;
+    const size_t old_capacity = profile->blocks_capacity;
+
+    size_t live_blocks = 0;
+    for (size_t i = 0; i < old_capacity; ++ i)
+        if (old_blocks[i].pointer != NULL && old_blocks[i].pointer != __SAFE_ALLOC_TOMBSTONE)
+            ++ live_blocks;
+
+    size_t new_capacity = 64;
+    while (new_capacity < 4 * live_blocks)
+        new_capacity *= 2;
+
+    profile->blocks = (__safe_alloc_block*) calloc(new_capacity, sizeof(*profile->blocks));
+    if (profile->blocks == NULL)
+        abort(); // Profiling can't continue without it
+
+    profile->blocks_capacity = new_capacity;
+    profile->blocks_used = 0;
+
+    for (size_t i = 0; i < old_capacity; ++ i)
+        if (old_blocks[i].pointer != NULL && old_blocks[i].pointer != __SAFE_ALLOC_TOMBSTONE)
+            __safe_alloc_insert_block(profile, old_blocks[i]);
+
+    free(old_blocks);
+}
+
+inline void __safe_alloc_insert_block(__safe_alloc_profile* profile, __safe_alloc_block block) {
+    // Tombstones count as used, so there's always an empty slot to stop probing
+    if (2 * (profile->blocks_used + 1) > profile->blocks_capacity)
+        __safe_alloc_rehash_blocks(profile);
+
+    size_t slot = __safe_alloc_block_slot(profile, block.pointer);
+    while (profile->blocks[slot].pointer != NULL)
+        slot = (slot + 1) & (profile->blocks_capacity - 1);
+
+    profile->blocks[slot] = block, ++ profile->blocks_used;
+}
+
+inline void __safe_alloc_site_grow(safe_alloc_site* site, size_t old_size, size_t new_size) {
+    site->live_bytes = site->live_bytes - old_size + new_size;
+
+    if (new_size > old_size)
+        site->total_bytes += new_size - old_size;
+
+    if (site->live_bytes > site->peak_live_bytes)
+        site->peak_live_bytes = site->live_bytes;
+}
+
+/**
+ * Account block, that was allocated (old_pointer is NULL) or
+ * reallocated from old_pointer to new_pointer with new size.
+ */
+inline void __safe_alloc_profile_record(void* old_pointer, void* new_pointer,
+                                        size_t size, occurance at) {
+    __safe_alloc_profile* profile = &__safe_alloc_global_profile;
+    pthread_mutex_lock(&profile->lock);
+
+    __safe_alloc_block* old_block = old_pointer == NULL ?
+        NULL : __safe_alloc_find_block(profile, old_pointer);
+
+    __safe_alloc_block block = {};
+
+    if (old_block != NULL) {
+        block = *old_block;
+        old_block->pointer = __SAFE_ALLOC_TOMBSTONE;
+
+        safe_alloc_site* site = &profile->sites[block.site];
+        __safe_alloc_site_grow(site, block.size, size);
+
+        ++ site->reallocations, ++ block.realloc_chain;
+        if (block.realloc_chain > site->longest_realloc_chain)
+            site->longest_realloc_chain = block.realloc_chain;
+    } else {
+        // Also blocks, that were allocated bypassing safe-alloc
+        block.site = __safe_alloc_find_site(profile, at);
+
+        safe_alloc_site* site = &profile->sites[block.site];
+        __safe_alloc_site_grow(site, 0, size);
+
+        ++ site->allocations;
+    }
+
+    block.pointer = new_pointer, block.size = size;
+    __safe_alloc_insert_block(profile, block);
+
+    pthread_mutex_unlock(&profile->lock);
+}
+
+inline void __safe_alloc_profile_forget(void* pointer) {
+    __safe_alloc_profile* profile = &__safe_alloc_global_profile;
+    pthread_mutex_lock(&profile->lock);
+
+    __safe_alloc_block* block = __safe_alloc_find_block(profile, pointer);
+
+    if (block != NULL) {
+        profile->sites[block->site].live_bytes -= block->size;
+        block->pointer = __SAFE_ALLOC_TOMBSTONE;
+    }
+
+    pthread_mutex_unlock(&profile->lock);
+}
+
+/**
+ * Copy statistics of every allocation site, at most max_sites of them.
+ * @return Number of sites, that were profiled so far
+ */
+inline size_t safe_alloc_profile_sites(safe_alloc_site* sites, size_t max_sites) {
+    __safe_alloc_profile* profile = &__safe_alloc_global_profile;
+    pthread_mutex_lock(&profile->lock);
+
+    const size_t count = profile->sites_count;
+    if (max_sites > 0)
+        memcpy(sites, profile->sites, (count < max_sites ? count : max_sites) * sizeof(*sites));
+
+    pthread_mutex_unlock(&profile->lock);
+    return count;
+}
+
+inline int __safe_alloc_compare_live_bytes(const void* first, const void* second) {
+    const size_t first_live  = ((const safe_alloc_site*)  first)->live_bytes,
+                 second_live = ((const safe_alloc_site*) second)->live_bytes;
+
+    return (first_live < second_live) - (first_live > second_live);
+}
+
+/**
+ * Print table of allocation sites, that hold the most memory first.
+ */
+inline void safe_alloc_print_profile(FILE* stream) {
+    const size_t count = safe_alloc_profile_sites(NULL, 0);
+
+    safe_alloc_site* sites = (safe_alloc_site*) calloc(count + 1, sizeof(*sites));
+    if (sites == NULL)
+        return;
+
+    const size_t copied = safe_alloc_profile_sites(sites, count);
+    const size_t shown = copied < count ? copied : count;
+
+    qsort(sites, shown, sizeof(*sites), __safe_alloc_compare_live_bytes);
+
+    fprintf(stream, "%-40s %12s %12s %12s %10s %8s %8s\n", "allocation site",
+            "live bytes", "peak bytes", "total bytes", "allocs", "reallocs", "chain");
+
+    for (size_t i = 0; i < shown; ++ i) {
+        const safe_alloc_site* site = &sites[i];
+
+        // Long paths are cut from the left, file name is more useful
+        const size_t file_length = strlen(site->allocated_at.file);
+        const char* file = file_length > 32 ?
+            site->allocated_at.file + file_length - 32 : site->allocated_at.file;
+
+        fprintf(stream, "%32s:%-7d %12zu %12zu %12zu %10zu %8zu %8zu\n",
+                file, site->allocated_at.line, site->live_bytes, site->peak_live_bytes,
+                site->total_bytes, site->allocations, site->reallocations,
+                site->longest_realloc_chain);
+    }
+
+    free(sites);
+}
+
+#else
+
+inline void __safe_alloc_profile_record(void*, void*, size_t, occurance) {}
+inline void __safe_alloc_profile_forget(void*) {}
+
+inline void safe_alloc_print_profile(FILE* stream) {
+    fprintf(stream, "Allocation profiling is disabled, build with SAFE_ALLOC_PROFILE\n");
+}
+
+#endif
+
+// ---------------------------- ALLOC -----------------------------
+
 template <typename E>
-stack_trace* safe_calloc(size_t number_of_members, E** allocated_space) {
+stack_trace* __safe_calloc(size_t number_of_members, E** allocated_space, occurance at) {
     E* new_space = (E*) calloc(number_of_members, sizeof(E));
 
     if (new_space == NULL)
         return FAILURE(RUNTIME_ERROR, "Calloc failed due to %s!"
-                       "\n\t" "    number of members: %d"
-                       "\n\t" "          member size: %d",
-                       "\n\t" "total requested bytes: %d",
+                       "\n\t" "    number of members: %zu"
+                       "\n\t" "          member size: %zu"
+                       "\n\t" "total requested bytes: %zu",
                        strerror(errno),
                        number_of_members,  sizeof(E),
                        number_of_members * sizeof(E));
 
+    __safe_alloc_profile_record(NULL, new_space, number_of_members * sizeof(E), at);
+
     *allocated_space = new_space; // Successfully allocated
     return SUCCESS();
 }
 
 template <typename E>
-stack_trace* safe_realloc(E** old_space, size_t number_of_members) {
-    E* new_space = (E*) realloc(old_space, number_of_members * sizeof(E));
+stack_trace* __safe_realloc(E** old_space, size_t number_of_members, occurance at) {
+    E* new_space = (E*) realloc(*old_space, number_of_members * sizeof(E));
     if (new_space == NULL)
         return FAILURE(RUNTIME_ERROR, "Realloc failed due to %s!"
-                       "\n\t"  "  reallocated pointer: %p" "\n",
-                       "\n\t"  "    number of members: %d"
-                       "\n\t"  "          member size: %d",
-                       "\n\t"  "total requested bytes: %d",
-                       strerror(errno), old_space,
+                       "\n\t"  "  reallocated pointer: %p"
+                       "\n\t"  "    number of members: %zu"
+                       "\n\t"  "          member size: %zu"
+                       "\n\t"  "total requested bytes: %zu",
+                       strerror(errno), (void*) *old_space,
                        number_of_members,  sizeof(E),
                        number_of_members * sizeof(E));
 
     // TODO: Add option to zero out memory 
 
+    __safe_alloc_profile_record(*old_space, new_space, number_of_members * sizeof(E), at);
+
     *old_space = new_space; // Successfully allocated
     return SUCCESS();
 }
+
+// Call site is remembered for allocation profiling
+#define safe_calloc(number_of_members, allocated_space)                       \
+    __safe_calloc(number_of_members, allocated_space, __TRACE_CREATE_OCCURANCE())
+
+#define safe_realloc(old_space, number_of_members)                            \
+    __safe_realloc(old_space, number_of_members, __TRACE_CREATE_OCCURANCE())
+
+/**
+ * Free memory from #safe_calloc or #safe_realloc,
+ * so profiling knows it's not live anymore.
+ */
+template <typename E>
+void safe_free(E* space) {
+    __safe_alloc_profile_forget((void*) space);
+    free((void*) space);
+}
+
+// ---------------------------- ARENA -----------------------------
+
+const size_t SAFE_ARENA_DEFAULT_CHUNK_SIZE = 4096;
+
+struct safe_arena_chunk {
+    safe_arena_chunk* next;
+
+    size_t size;
+    size_t used;
+
+    alignas(max_align_t) char data[];
+};
+
+/**
+ * Bump allocator for lots of small objects, that all die together.
+ * Objects are never freed one by one, whole arena is either reset
+ * (chunks are kept for reuse) or destroyed at once.
+ */
+struct safe_arena {
+    safe_arena_chunk* first;
+    safe_arena_chunk* current;
+
+    size_t initial_chunk_size;
+};
+
+inline stack_trace* __safe_arena_allocate_chunk(size_t size, safe_arena_chunk** chunk) {
+    safe_arena_chunk* new_chunk = (safe_arena_chunk*) malloc(sizeof(*new_chunk) + size);
+
+    if (new_chunk == NULL)
+        return FAILURE(RUNTIME_ERROR, "Arena chunk allocation failed due to %s!"
+                       "\n\t" "chunk size: %zu", strerror(errno), size);
+
+    *new_chunk = { .next = NULL, .size = size, .used = 0 };
+
+    *chunk = new_chunk;
+    return SUCCESS();
+}
+
+inline stack_trace* safe_arena_create(safe_arena* arena,
+                                      size_t initial_chunk_size = SAFE_ARENA_DEFAULT_CHUNK_SIZE) {
+    *arena = { .first = NULL, .current = NULL, .initial_chunk_size = initial_chunk_size };
+
+    TRY __safe_arena_allocate_chunk(initial_chunk_size, &arena->first)
+        FAIL("Arena creation failed!");
+
+    arena->current = arena->first;
+    return SUCCESS();
+}
+
+// Next chunk is at least twice as big, so there are only logarithmically many of them
+inline stack_trace* __safe_arena_next_chunk(safe_arena* arena, size_t size) {
+    safe_arena_chunk* current = arena->current;
+
+    // Reuse chunks left after reset, if they're big enough
+    if (current->next != NULL && current->next->size >= size) {
+        arena->current = current->next;
+        arena->current->used = 0;
+
+        return SUCCESS();
+    }
+
+    size_t new_size = 2 * current->size;
+    while (new_size < size)
+        new_size *= 2;
+
+    safe_arena_chunk* new_chunk = NULL;
+    TRY __safe_arena_allocate_chunk(new_size, &new_chunk)
+        FAIL("Arena expanding failed!");
+
+    new_chunk->next = current->next;
+    current->next = new_chunk;
+
+    arena->current = new_chunk;
+    return SUCCESS();
+}
+
+/**
+ * Zero initialized space for number_of_members elements, which
+ * lives until arena is reset or destroyed, like #safe_calloc.
+ */
+template <typename E>
+stack_trace* safe_arena_alloc(safe_arena* arena, size_t number_of_members, E** allocated_space) {
+    static_assert(alignof(E) <= alignof(max_align_t),
+                  "Chunk data is only aligned to max_align_t!");
+
+    if (number_of_members > SIZE_MAX / sizeof(E))
+        return FAILURE(RUNTIME_ERROR, "Arena allocation size overflows!"
+                       "\n\t" "number of members: %zu"
+                       "\n\t" "      member size: %zu", number_of_members, sizeof(E));
+
+    const size_t size = number_of_members * sizeof(E);
+
+    // Chunk data is aligned to max_align_t, so aligning offset is enough
+    size_t start = (arena->current->used + alignof(E) - 1) / alignof(E) * alignof(E);
+
+    if (start + size > arena->current->size) {
+        TRY __safe_arena_next_chunk(arena, size)
+            FAIL("Arena allocation failed!");
+
+        start = 0;
+    }
+
+    E* new_space = (E*) (arena->current->data + start);
+    memset((void*) new_space, 0, size);
+
+    arena->current->used = start + size;
+
+    *allocated_space = new_space; // Successfully allocated
+    return SUCCESS();
+}
+
+/**
+ * Free everything allocated from arena at once, chunks are kept for reuse.
+ */
+inline void safe_arena_reset(safe_arena* arena) {
+    // Following chunks are cleared lazily, when allocation reaches them
+    arena->current = arena->first;
+    arena->current->used = 0;
+}
+
+inline void safe_arena_destroy(safe_arena* arena) {
+    for (safe_arena_chunk* chunk = arena->first; chunk != NULL; ) {
+        safe_arena_chunk* next = chunk->next;
+        free(chunk), chunk = next;
+    }
+
+    *arena = {};
+}
+
+// ----------------------------- POOL -----------------------------
+
+const size_t OBJECT_POOL_DEFAULT_SLAB_SIZE = 64;
+const size_t OBJECT_POOL_CACHE_SIZE = 32;
+
+// Number of pools of the same type, that every thread caches objects for
+const size_t OBJECT_POOL_THREAD_CACHES = 4;
+
+// Free object keeps pointer to the next free one right inside of itself
+template <typename T>
+union object_pool_slot {
+    object_pool_slot* next;
+    alignas(T) char object[sizeof(T)];
+};
+
+// Part of the pool, that thread caches refer to, so it outlives pool until they let go
+template <typename T>
+struct __object_pool_shared {
+    pthread_mutex_t lock;
+    object_pool_slot<T>* free_list;
+
+    size_t generation; //!< Changed by release, caches of older generations are stale
+    size_t references; //!< Pool itself and every thread cache for it
+
+    bool alive; //!< Cleared by destroy, cached objects are dropped after that
+};
+
+/**
+ * Pool of fixed size objects, that are carved from arena in slabs, so
+ * they're packed densely. Freed objects are reused through free list,
+ * every thread keeps small caches of them for a few pools to avoid
+ * taking lock, cache is given back to it's pool, when it's evicted.
+ *
+ * @note Objects can be freed from any thread, but pool
+ *       shouldn't be destroyed while other threads use it.
+ */
+template <typename T>
+struct object_pool {
+    safe_arena slabs;
+    size_t slab_size;
+
+    __object_pool_shared<T>* shared;
+};
+
+template <typename T>
+struct __object_pool_cache {
+    __object_pool_shared<T>* pool; //!< NULL if cache isn't used
+    size_t generation;
+
+    object_pool_slot<T>* free_list;
+    size_t size;
+};
+
+template <typename T>
+inline void __object_pool_drop_reference(__object_pool_shared<T>* shared) {
+    pthread_mutex_lock(&shared->lock);
+    const bool is_last = -- shared->references == 0;
+    pthread_mutex_unlock(&shared->lock);
+
+    if (is_last) {
+        pthread_mutex_destroy(&shared->lock);
+        free(shared);
+    }
+}
+
+// Give cached objects back to their pool, if they're still valid
+template <typename T>
+inline void __object_pool_detach_cache(__object_pool_cache<T>* cache) {
+    __object_pool_shared<T>* shared = cache->pool;
+    if (shared == NULL)
+        return;
+
+    pthread_mutex_lock(&shared->lock);
+
+    if (shared->alive && shared->generation == cache->generation)
+        while (cache->free_list != NULL) {
+            object_pool_slot<T>* slot = cache->free_list;
+            cache->free_list = slot->next;
+
+            slot->next = shared->free_list;
+            shared->free_list = slot;
+        }
+
+    pthread_mutex_unlock(&shared->lock);
+
+    __object_pool_drop_reference(shared);
+    *cache = {};
+}
+
+// Caches of one thread, most recently used first
+template <typename T>
+struct __object_pool_thread_caches {
+    __object_pool_cache<T> caches[OBJECT_POOL_THREAD_CACHES];
+
+    ~__object_pool_thread_caches() {
+        for (size_t i = 0; i < OBJECT_POOL_THREAD_CACHES; ++ i)
+            __object_pool_detach_cache(&caches[i]);
+    }
+};
+
+template <typename T>
+inline __object_pool_cache<T>* __object_pool_thread_cache(object_pool<T>* pool) {
+    thread_local __object_pool_thread_caches<T> thread_caches = {};
+    __object_pool_cache<T>* caches = thread_caches.caches;
+
+    __object_pool_shared<T>* shared = pool->shared;
+
+    size_t found = 0;
+    while (found < OBJECT_POOL_THREAD_CACHES && caches[found].pool != shared)
+        ++ found;
+
+    if (found == OBJECT_POOL_THREAD_CACHES) {
+        // Least recently used cache makes room for this pool
+        found = OBJECT_POOL_THREAD_CACHES - 1;
+        __object_pool_detach_cache(&caches[found]);
+
+        pthread_mutex_lock(&shared->lock);
+        ++ shared->references;
+        pthread_mutex_unlock(&shared->lock);
+
+        caches[found] = { .pool = shared, .generation = 0, .free_list = NULL, .size = 0 };
+    }
+
+    __object_pool_cache<T> cache = caches[found];
+    memmove((void*) (caches + 1), (void*) caches, found * sizeof(*caches));
+
+    // Objects cached before pool was released aren't valid anymore
+    const size_t generation = __atomic_load_n(&shared->generation, __ATOMIC_ACQUIRE);
+    if (cache.generation != generation)
+        cache = { .pool = shared, .generation = generation, .free_list = NULL, .size = 0 };
+
+    caches[0] = cache;
+    return &caches[0];
+}
+
+template <typename T>
+stack_trace* object_pool_create(object_pool<T>* pool,
+                                size_t slab_size = OBJECT_POOL_DEFAULT_SLAB_SIZE) {
+    pool->slab_size = slab_size;
+
+    __object_pool_shared<T>* shared =
+        (__object_pool_shared<T>*) calloc(1, sizeof(*shared));
+
+    if (shared == NULL)
+        return FAILURE(RUNTIME_ERROR, "Pool creation failed due to %s!", strerror(errno));
+
+    stack_trace* trace =
+        safe_arena_create(&pool->slabs, slab_size * sizeof(object_pool_slot<T>));
+
+    if (!trace_is_success(trace)) {
+        free(shared);
+        return PASS_FAILURE(trace, RUNTIME_ERROR, "Pool creation failed!");
+    }
+
+    pthread_mutex_init(&shared->lock, NULL);
+    shared->references = 1, shared->alive = true;
+
+    pool->shared = shared;
+    return SUCCESS();
+}
+
+// Take up to half of the cache from shared free list, or carve new slab
+template <typename T>
+inline stack_trace* __object_pool_refill_cache(object_pool<T>* pool,
+                                               __object_pool_cache<T>* cache) {
+    __object_pool_shared<T>* shared = pool->shared;
+    pthread_mutex_lock(&shared->lock);
+
+    while (shared->free_list != NULL && cache->size < OBJECT_POOL_CACHE_SIZE / 2) {
+        object_pool_slot<T>* slot = shared->free_list;
+        shared->free_list = slot->next;
+
+        slot->next = cache->free_list;
+        cache->free_list = slot, ++ cache->size;
+    }
+
+    if (cache->size == 0) {
+        object_pool_slot<T>* slab = NULL;
+
+        stack_trace* trace = safe_arena_alloc(&pool->slabs, pool->slab_size, &slab);
+        pthread_mutex_unlock(&shared->lock);
+
+        if (!trace_is_success(trace))
+            return PASS_FAILURE(trace, RUNTIME_ERROR, "Pool expanding failed!");
+
+        // Linked in order, so consecutive allocations are adjacent
+        for (size_t i = pool->slab_size; i > 0; -- i)
+            slab[i - 1].next = cache->free_list, cache->free_list = &slab[i - 1];
+
+        cache->size = pool->slab_size;
+        return SUCCESS();
+    }
+
+    pthread_mutex_unlock(&shared->lock);
+    return SUCCESS();
+}
+
+/**
+ * Zero initialized object from pool, like #safe_calloc with one member.
+ */
+template <typename T>
+stack_trace* object_pool_alloc(object_pool<T>* pool, T** allocated_object) {
+    __object_pool_cache<T>* cache = __object_pool_thread_cache(pool);
+
+    if (cache->free_list == NULL)
+        TRY __object_pool_refill_cache(pool, cache)
+            FAIL("Pool allocation failed!");
+
+    object_pool_slot<T>* slot = cache->free_list;
+    cache->free_list = slot->next, -- cache->size;
+
+    memset((void*) slot, 0, sizeof(*slot));
+
+    *allocated_object = (T*) slot->object; // Successfully allocated
+    return SUCCESS();
+}
+
+template <typename T>
+void object_pool_free(object_pool<T>* pool, T* object) {
+    __object_pool_cache<T>* cache = __object_pool_thread_cache(pool);
+
+    object_pool_slot<T>* slot = (object_pool_slot<T>*) object;
+    slot->next = cache->free_list;
+    cache->free_list = slot, ++ cache->size;
+
+    if (cache->size < OBJECT_POOL_CACHE_SIZE)
+        return;
+
+    // Cache is full, give half of it back to other threads
+    __object_pool_shared<T>* shared = pool->shared;
+    pthread_mutex_lock(&shared->lock);
+
+    while (cache->size > OBJECT_POOL_CACHE_SIZE / 2) {
+        slot = cache->free_list;
+        cache->free_list = slot->next, -- cache->size;
+
+        slot->next = shared->free_list;
+        shared->free_list = slot;
+    }
+
+    pthread_mutex_unlock(&shared->lock);
+}
+
+/**
+ * Free every object of the pool at once, slabs are kept for reuse.
+ */
+template <typename T>
+void object_pool_release(object_pool<T>* pool) {
+    __object_pool_shared<T>* shared = pool->shared;
+    pthread_mutex_lock(&shared->lock);
+
+    __atomic_store_n(&shared->generation, shared->generation + 1, __ATOMIC_RELEASE);
+    shared->free_list = NULL;
+
+    safe_arena_reset(&pool->slabs);
+
+    pthread_mutex_unlock(&shared->lock);
+}
+
+template <typename T>
+void object_pool_destroy(object_pool<T>* pool) {
+    __object_pool_shared<T>* shared = pool->shared;
+
+    // Caches still refer to it, but never give their objects back
+    pthread_mutex_lock(&shared->lock);
+    shared->alive = false, shared->free_list = NULL;
+    pthread_mutex_unlock(&shared->lock);
+
+    __object_pool_drop_reference(shared);
+    safe_arena_destroy(&pool->slabs);
+
+    pool->shared = NULL;
+}
+
+// ---------------------------- BUFFER ----------------------------
+
+/**
+ * Where growable buffer lives, decided only by it's size, so buffer
+ * owner doesn't need to remember anything but number of elements.
+ * Big buffers get their own mapping and are resized with mremap,
+ * which moves page table entries instead of copying memory.
+ *
+ * Containers opt in one by one, so far only linked_list does: non-guard
+ * protected_stack still grows it's buffer with plain realloc.
+ */
+struct safe_buffer_policy {
+    size_t mmap_threshold; //!< Buffers of at least that many bytes are mapped
+    bool huge_pages;       //!< Ask for transparent huge pages for mapped buffers
+};
+
+const safe_buffer_policy SAFE_BUFFER_HEAP_POLICY = {
+    .mmap_threshold = SIZE_MAX, .huge_pages = false
+};
+
+const safe_buffer_policy SAFE_BUFFER_DEFAULT_POLICY = {
+    .mmap_threshold = 1 << 20, .huge_pages = false
+};
+
+const safe_buffer_policy SAFE_BUFFER_HUGE_PAGES_POLICY = {
+    .mmap_threshold = 1 << 20, .huge_pages = true
+};
+
+inline bool __safe_buffer_is_mapped(const safe_buffer_policy* policy, size_t size) {
+    // No policy at all means plain heap, so zeroed containers keep working
+    return policy != NULL && size > 0 && size >= policy->mmap_threshold;
+}
+
+inline size_t __safe_buffer_mapping_size(size_t size) {
+    const size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    return (size + page_size - 1) / page_size * page_size;
+}
+
+inline void __safe_buffer_advise(const safe_buffer_policy* policy, void* mapping, size_t size) {
+#ifdef MADV_HUGEPAGE
+    // Only a hint, buffer works the same if kernel ignores it
+    if (policy->huge_pages)
+        madvise(mapping, size, MADV_HUGEPAGE);
+#else
+    (void) policy, (void) mapping, (void) size;
+#endif
+}
+
+inline stack_trace* __safe_buffer_map(const safe_buffer_policy* policy, size_t size, void** mapping) {
+    void* new_mapping = mmap(NULL, __safe_buffer_mapping_size(size), PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (new_mapping == MAP_FAILED)
+        return FAILURE(RUNTIME_ERROR, "Buffer mapping failed due to %s!"
+                       "\n\t" "requested bytes: %zu", strerror(errno), size);
+
+    __safe_buffer_advise(policy, new_mapping, __safe_buffer_mapping_size(size));
+
+    *mapping = new_mapping;
+    return SUCCESS();
+}
+
+inline stack_trace* __safe_buffer_resize_bytes(const safe_buffer_policy* policy, void** space,
+                                               size_t old_size, size_t new_size) {
+    const bool was_mapped = __safe_buffer_is_mapped(policy, old_size),
+               is_mapped  = __safe_buffer_is_mapped(policy, new_size);
+
+    void* new_space = NULL;
+
+    if (!was_mapped && !is_mapped) {
+        new_space = *space == NULL ? calloc(1, new_size) : realloc(*space, new_size);
+
+        if (new_space == NULL && new_size > 0)
+            return FAILURE(RUNTIME_ERROR, "Buffer reallocation failed due to %s!"
+                           "\n\t" "requested bytes: %zu", strerror(errno), new_size);
+
+    } else if (was_mapped && is_mapped) {
+        const size_t old_mapping_size = __safe_buffer_mapping_size(old_size),
+                     new_mapping_size = __safe_buffer_mapping_size(new_size);
+
+        new_space = *space;
+        if (old_mapping_size != new_mapping_size) {
+            new_space = mremap(*space, old_mapping_size, new_mapping_size, MREMAP_MAYMOVE);
+
+            if (new_space == MAP_FAILED)
+                return FAILURE(RUNTIME_ERROR, "Buffer remapping failed due to %s!"
+                               "\n\t" "requested bytes: %zu", strerror(errno), new_size);
+
+            __safe_buffer_advise(policy, new_space, new_mapping_size);
+        }
+
+    } else if (is_mapped) {
+        // Buffer just crossed threshold, it's copied once to it's own mapping
+        TRY __safe_buffer_map(policy, new_size, &new_space)
+            FAIL("Buffer expanding failed!");
+
+        if (*space != NULL)
+            memcpy(new_space, *space, old_size);
+
+        free(*space);
+
+    } else {
+        new_space = malloc(new_size);
+        if (new_space == NULL)
+            return FAILURE(RUNTIME_ERROR, "Buffer shrinking failed due to %s!"
+                           "\n\t" "requested bytes: %zu", strerror(errno), new_size);
+
+        memcpy(new_space, *space, new_size);
+        munmap(*space, __safe_buffer_mapping_size(old_size));
+    }
+
+    *space = new_space;
+    return SUCCESS();
+}
+
+/**
+ * Resize buffer of old_number_of_members to new_number_of_members elements,
+ * memory is placed according to policy. Buffer is zeroed, if it's created
+ * (space is NULL), otherwise new elements are uninitialized, like in realloc.
+ * On failure old buffer stays untouched.
+ */
+template <typename E>
+stack_trace* __safe_buffer_resize(E** space, size_t old_number_of_members,
+                                  size_t new_number_of_members, occurance at,
+                                  const safe_buffer_policy* policy = &SAFE_BUFFER_DEFAULT_POLICY) {
+
+    if (new_number_of_members > SIZE_MAX / sizeof(E))
+        return FAILURE(RUNTIME_ERROR, "Buffer size overflows!"
+                       "\n\t" "number of members: %zu"
+                       "\n\t" "      member size: %zu", new_number_of_members, sizeof(E));
+
+    void* new_space = (void*) *space;
+
+    TRY __safe_buffer_resize_bytes(policy, &new_space, old_number_of_members * sizeof(E),
+                                                       new_number_of_members * sizeof(E))
+        FAIL("Buffer resizing failed!");
+
+    // Accounted like realloc, mapped buffers included
+    if (new_space != NULL)
+        __safe_alloc_profile_record((void*) *space, new_space,
+                                    new_number_of_members * sizeof(E), at);
+    else
+        __safe_alloc_profile_forget((void*) *space); // Shrunk to nothing
+
+    *space = (E*) new_space; // Successfully resized
+    return SUCCESS();
+}
+
+// Call site is remembered for allocation profiling, policy can be omitted
+#define safe_buffer_resize(space, old_number_of_members, new_number_of_members, ...)    \
+    __safe_buffer_resize(space, old_number_of_members, new_number_of_members,           \
+                         __TRACE_CREATE_OCCURANCE() __VA_OPT__(,) __VA_ARGS__)
+
+/**
+ * Free buffer, that was created with #safe_buffer_resize with the same policy.
+ */
+template <typename E>
+void safe_buffer_free(E* space, size_t number_of_members,
+                      const safe_buffer_policy* policy = &SAFE_BUFFER_DEFAULT_POLICY) {
+    const size_t size = number_of_members * sizeof(E);
+    __safe_alloc_profile_forget((void*) space);
+
+    if (__safe_buffer_is_mapped(policy, size))
+        munmap((void*) space, __safe_buffer_mapping_size(size));
+    else
+        free((void*) space);
+}
@@ -0,0 +1,74 @@
+#include "segmented-stack.h"
+#include "test-framework.h"
+
+TEST(populate_segmented_stack_with_numbers) {
+    segmented_stack<int> stack = {};
+    TRY segmented_stack_create(&stack, 4)
+        ASSERT_SUCCESS();
+
+    const int size = 100000;
+
+    int* first = NULL;
+    TRY segmented_stack_push(&stack, 0, &first)
+        ASSERT_SUCCESS();
+
+    for (int i = 1; i < size; ++ i)
+        TRY segmented_stack_push(&stack, i)
+            ASSERT_SUCCESS();
+
+    // Growth never moves elements
+    ASSERT_EQUAL(first == segmented_stack_get(&stack, 0), true);
+    ASSERT_EQUAL(*segmented_stack_get(&stack, 12345), 12345);
+
+    int expected = 0;
+    SEGMENTED_STACK_TRAVERSE(&stack, int, current)
+        ASSERT_EQUAL(*current, expected ++);
+
+    ASSERT_EQUAL(expected, size);
+
+    for (int i = size - 1; i >= 0; -- i) {
+        int value = -1;
+        TRY segmented_stack_pop(&stack, &value)
+            ASSERT_SUCCESS();
+
+        ASSERT_EQUAL(value, i);
+    }
+
+    ASSERT_EQUAL(segmented_stack_empty(&stack), true);
+    ASSERT_EQUAL(segmented_stack_peek(&stack) == NULL, true);
+
+    segmented_stack_destroy(&stack);
+}
+
+TEST(oscillate_around_segment_boundary) {
+    segmented_stack<int> stack = {};
+    TRY segmented_stack_create(&stack, 4)
+        ASSERT_SUCCESS();
+
+    for (int i = 0; i < 4; ++ i)
+        TRY segmented_stack_push(&stack, i)
+            ASSERT_SUCCESS();
+
+    int value = -1;
+    TRY segmented_stack_push(&stack, 4)
+        ASSERT_SUCCESS();
+
+    TRY segmented_stack_pop(&stack, &value)
+        ASSERT_SUCCESS();
+
+    ASSERT_EQUAL(value, 4);
+
+    // Second segment stays in stock and gets reused
+    segmented_stack_segment<int>* spare = stack.top->next;
+    ASSERT_EQUAL(spare != NULL, true);
+
+    TRY segmented_stack_push(&stack, 5)
+        ASSERT_SUCCESS();
+
+    ASSERT_EQUAL(stack.top == spare, true);
+    ASSERT_EQUAL(*segmented_stack_peek(&stack), 5);
+
+    segmented_stack_destroy(&stack);
+}
+
+TEST_MAIN()
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <type_traits>
+
+/**
+ * Stack made of chain of segments, each next one is twice as big as
+ * previous. Elements are never copied on growth, so pointers to elements
+ * stay valid for as long as they're on the stack, and push doesn't
+ * need twice as much memory for a moment like realloc does.
+ *
+ * Segments are only allocated and freed, push and pop take O(1) in the
+ * worst case. One emptied segment is kept in stock, so push/pop workload
+ * oscillating around segment boundary doesn't call allocator every time.
+ */
+template <typename E>
+struct segmented_stack_segment {
+    segmented_stack_segment<E>* prev; //!< Towards bottom of the stack
+    segmented_stack_segment<E>* next; //!< Towards top, can be empty one in stock
+
+    size_t capacity, used;
+    E* elements; //!< Placed right after segment header
+};
+
+template <typename E>
+struct segmented_stack {
+    static_assert(std::is_trivially_copyable_v<E>,
+                  "Elements are assigned into raw segment memory and never destroyed!");
+
+    segmented_stack_segment<E>* bottom;
+    segmented_stack_segment<E>* top; //!< Segment, that contains top element
+
+    size_t size;
+};
+
+
+template <typename E>
+static inline stack_trace* __segmented_stack_allocate_segment(size_t capacity,
+                                                              segmented_stack_segment<E>* prev,
+                                                              segmented_stack_segment<E>** segment) {
+    // Make sure elements are properly aligned after header
+    const size_t header_size = (sizeof(segmented_stack_segment<E>) + alignof(E) - 1)
+                               / alignof(E) * alignof(E);
+
+    char* space = (char*) malloc(header_size + capacity * sizeof(E));
+    if (space == NULL)
+        return FAILURE(RUNTIME_ERROR, "Failed to allocate segment of %zu elements: %s",
+                       capacity, strerror(errno));
+
+    *segment = (segmented_stack_segment<E>*) space;
+    **segment = {
+        .prev = prev, .next = NULL,
+        .capacity = capacity, .used = 0,
+        .elements = (E*) (space + header_size)
+    };
+
+    return SUCCESS();
+}
+
+template <typename E>
+stack_trace* segmented_stack_create(segmented_stack<E>* stack,
+                                    const size_t initial_capacity = 16) {
+    *stack = {};
+
+    TRY __segmented_stack_allocate_segment<E>(initial_capacity > 0 ? initial_capacity : 1,
+                                              NULL, &stack->bottom)
+        FAIL("Failed to allocate first segment!");
+
+    stack->top = stack->bottom;
+    return SUCCESS();
+}
+
+template <typename E>
+void segmented_stack_destroy(segmented_stack<E>* stack) {
+    if (stack == NULL)
+        return; // Do nothing if stack is NULL (like free)
+
+    segmented_stack_segment<E>* current = stack->bottom;
+    while (current != NULL) {
+        segmented_stack_segment<E>* next = current->next;
+        free(current);
+        current = next;
+    }
+
+    *stack = {};
+}
+
+
+template <typename E>
+stack_trace* segmented_stack_push(segmented_stack<E>* stack, const E value,
+                                  E** actual_place = NULL) {
+    segmented_stack_segment<E>* top = stack->top;
+
+    if (top->used == top->capacity) {
+        if (top->next == NULL) {
+            const size_t GROW = 2; // Each segment is that much bigger than previous
+
+            TRY __segmented_stack_allocate_segment(top->capacity * GROW, top, &top->next)
+                FAIL("Failed to expand stack of size %zu!", stack->size);
+        }
+
+        top = stack->top = top->next;
+    }
+
+    E* place = &top->elements[top->used ++];
+    *place = value;
+
+    ++ stack->size;
+
+    if (actual_place != NULL)
+        *actual_place = place;
+
+    return SUCCESS();
+}
+
+template <typename E>
+stack_trace* segmented_stack_pop(segmented_stack<E>* stack, E* const value) {
+    if (stack->size == 0)
+        return FAILURE(RUNTIME_ERROR, "Popping failed because stack is empty!");
+
+    segmented_stack_segment<E>* top = stack->top;
+    *value = top->elements[-- top->used];
+
+    -- stack->size;
+
+    if (top->used == 0 && top->prev != NULL) {
+        // Keep this segment in stock, but only this one
+        if (top->next != NULL)
+            free(top->next), top->next = NULL;
+
+        stack->top = top->prev;
+    }
+
+    return SUCCESS();
+}
+
+template <typename E>
+E* segmented_stack_peek(segmented_stack<E>* stack) {
+    if (stack->size == 0)
+        return NULL;
+
+    return &stack->top->elements[stack->top->used - 1];
+}
+
+template <typename E>
+bool segmented_stack_empty(segmented_stack<E>* stack) {
+    return stack->size == 0;
+}
+
+/**
+ * Pointer to element with index counted from the bottom of the stack,
+ * takes O(log(size)), because it walks segments from the top.
+ */
+template <typename E>
+E* segmented_stack_get(segmented_stack<E>* stack, const size_t index) {
+    if (index >= stack->size)
+        return NULL;
+
+    size_t segment_start = stack->size - stack->top->used;
+
+    segmented_stack_segment<E>* current = stack->top;
+    while (index < segment_start) {
+        current = current->prev;
+        segment_start -= current->used;
+    }
+
+    return &current->elements[index - segment_start];
+}
+
+// From bottom to top, break only leaves current segment
+#define SEGMENTED_STACK_TRAVERSE(stack, type, current)                              \
+    for (segmented_stack_segment<type>* __segment = (stack)->bottom;                \
+            __segment != NULL && __segment->used > 0;                               \
+            __segment = __segment->next)                                            \
+        for (type* current = __segment->elements;                                   \
+                current < __segment->elements + __segment->used; ++ current)
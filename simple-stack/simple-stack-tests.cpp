@@ -0,0 +1,157 @@
+#include "simple-stack.h"
+#include "test-framework.h"
+
+// Owns heap memory, so sanitizers catch elements, that are lost,
+// copied bytewise or destroyed twice, and counts live instances
+struct tracked {
+    int* value;
+
+    static int live;
+
+    tracked(int new_value): value(new int(new_value)) { ++ live; }
+
+    tracked(const tracked& other): value(new int(*other.value)) { ++ live; }
+    tracked(tracked&& other): value(other.value) { other.value = NULL, ++ live; }
+
+    tracked& operator=(const tracked& other) = delete;
+    tracked& operator=(tracked&& other) = delete;
+
+    ~tracked() { delete value, -- live; }
+};
+
+int tracked::live = 0;
+
+template <typename E, size_t N>
+static bool is_inline(simple_stack<E, N>* stack) {
+    return stack->elements == (E*) stack->inline_space;
+}
+
+TEST(populate_heap_stack_with_numbers) {
+    simple_stack<int> stack = {};
+    simple_stack_create(&stack);
+
+    const int size = 1000;
+
+    for (int i = 0; i < size; ++ i)
+        simple_stack_push(&stack, i);
+
+    ASSERT_EQUAL(simple_stack_peek(&stack), size - 1);
+
+    for (int i = size - 1; i >= 0; -- i)
+        ASSERT_EQUAL(simple_stack_pop(&stack), i);
+
+    ASSERT_EQUAL((int) stack.next_index, 0);
+    simple_stack_destruct(&stack);
+}
+
+TEST(push_and_pop_ranges) {
+    simple_stack<int> stack = {};
+    simple_stack_create(&stack);
+
+    int values[100] = {};
+    for (int i = 0; i < 100; ++ i)
+        values[i] = i;
+
+    simple_stack_push(&stack, -1);
+    simple_stack_push_range(&stack, values, 100);
+
+    // Reallocated at most once for the whole range
+    ASSERT_EQUAL(stack.length >= 101, true);
+
+    int popped[100] = {};
+    simple_stack_pop_range(&stack, popped + 60, 40);
+    simple_stack_pop_range(&stack, popped, 60);
+
+    for (int i = 0; i < 100; ++ i)
+        ASSERT_EQUAL(popped[i], i);
+
+    ASSERT_EQUAL(simple_stack_pop(&stack), -1);
+    simple_stack_destruct(&stack);
+}
+
+TEST(shrink_back_into_inline_space) {
+    simple_stack<int, 16> stack = {};
+    simple_stack_create(&stack);
+
+    ASSERT_EQUAL(is_inline(&stack), true);
+
+    for (int i = 0; i < 100; ++ i)
+        simple_stack_push(&stack, i);
+
+    ASSERT_EQUAL(is_inline(&stack), false);
+
+    for (int i = 99; i >= 5; -- i)
+        ASSERT_EQUAL(simple_stack_pop(&stack), i);
+
+    // Heap isn't needed anymore, elements moved back inside
+    ASSERT_EQUAL(is_inline(&stack), true);
+
+    for (int i = 4; i >= 0; -- i)
+        ASSERT_EQUAL(simple_stack_pop(&stack), i);
+
+    simple_stack_destruct(&stack);
+}
+
+TEST(move_non_trivial_elements_through_heap) {
+    {
+        simple_stack<tracked> stack = {};
+        simple_stack_create(&stack);
+
+        for (int i = 0; i < 100; ++ i)
+            ASSERT_EQUAL(*simple_stack_emplace(&stack, i)->value, i);
+
+        ASSERT_EQUAL(tracked::live, 100);
+
+        for (int i = 99; i >= 50; -- i) {
+            tracked top = simple_stack_pop(&stack);
+            ASSERT_EQUAL(*top.value, i);
+        }
+
+        ASSERT_EQUAL(tracked::live, 50);
+
+        // Rest is destroyed along with stack
+        simple_stack_destruct(&stack);
+    }
+
+    ASSERT_EQUAL(tracked::live, 0);
+}
+
+TEST(move_non_trivial_elements_through_inline_space) {
+    {
+        simple_stack<tracked, 16> stack = {};
+        simple_stack_create(&stack);
+
+        tracked first(0), second(1);
+        const tracked range[] = { first, second };
+
+        // Copied, range keeps it's elements
+        for (int i = 0; i < 50; ++ i)
+            simple_stack_push_range(&stack, range, 2);
+
+        ASSERT_EQUAL(is_inline(&stack), false);
+        ASSERT_EQUAL(tracked::live, 104);
+
+        // Output is uninitialized, elements are moved there
+        alignas(tracked) char output_space[96 * sizeof(tracked)];
+        tracked* output = (tracked*) output_space;
+
+        simple_stack_pop_range(&stack, output, 96);
+        ASSERT_EQUAL(is_inline(&stack), true);
+
+        for (int i = 0; i < 96; ++ i) {
+            ASSERT_EQUAL(*output[i].value, i % 2);
+            output[i].~tracked();
+        }
+
+        for (int i = 3; i >= 0; -- i)
+            ASSERT_EQUAL(*simple_stack_pop(&stack).value, i % 2);
+
+        simple_stack_destruct(&stack);
+    }
+
+    ASSERT_EQUAL(tracked::live, 0);
+}
+
+int main(void) {
+    return test_framework_run_all_unit_tests();
+}
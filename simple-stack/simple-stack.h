@@ -2,76 +2,246 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <type_traits>
 #include <assert.h>
 
-template <typename E>
+#include "stack-growth-policy.h"
+
+/**
+ * Stack, that keeps first N elements inside of itself, so short-lived
+ * stacks don't touch heap at all until they overflow. With N = 0 (default)
+ * all the elements are in heap.
+ *
+ * Trivially copyable elements are moved around with memcpy and realloc,
+ * all the other ones are move-constructed and destroyed properly.
+ *
+ * @note Stack with N > 0 points into itself, so it mustn't be
+ *       copied or moved around after #simple_stack_create.
+ */
+template <typename E, size_t N = 0>
 struct simple_stack {
     E* elements;
 
     size_t length;
     size_t next_index;
-};
 
-static const size_t init_nmemb = 10;
+    const stack_growth_policy* growth_policy;
 
-static const size_t grow_coefficient = 2.0;
+    // Raw space, so elements aren't constructed together with stack
+    alignas(E) char inline_space[N * sizeof(E)];
+};
 
 template <typename E>
-void simple_stack_create(simple_stack<E>* const stack) {
-    stack->elements = (E*) calloc(sizeof(E), init_nmemb);
+constexpr bool __simple_stack_is_trivial = std::is_trivially_copyable_v<E>;
 
-    stack->length = init_nmemb;
-    stack->next_index = 0;
+template <typename E, size_t N>
+inline E* __simple_stack_inline_elements(simple_stack<E, N>* const stack) {
+    return (E*) stack->inline_space;
 }
 
+template <typename E, size_t N>
+inline bool __simple_stack_is_inline(simple_stack<E, N>* const stack) {
+    return N > 0 && stack->elements == __simple_stack_inline_elements(stack);
+}
+
+/**
+ * Move count elements from source to uninitialized destination,
+ * source elements are destroyed after that.
+ */
 template <typename E>
-void simple_stack_push(simple_stack<E>* const stack, const E element) {
-    if (stack->length == stack->next_index) {
-        stack->length *= grow_coefficient;
-        E* new_space = (E*) realloc(stack->elements, stack->length * sizeof(E));
+inline void __simple_stack_relocate(E* destination, E* source, size_t count) {
+    if constexpr (__simple_stack_is_trivial<E>)
+        memcpy((void*) destination, (const void*) source, count * sizeof(E));
+    else
+        for (size_t i = 0; i < count; ++ i) {
+            new (&destination[i]) E(std::move(source[i]));
+            source[i].~E();
+        }
+}
+
+template <typename E, size_t N>
+void __simple_stack_reallocate(simple_stack<E, N>* const stack, size_t new_length) {
+    if (N > 0 && new_length <= N) {
+        // Everything fits back inside, heap isn't needed anymore
+        if (!__simple_stack_is_inline(stack)) {
+            __simple_stack_relocate(__simple_stack_inline_elements(stack),
+                                    stack->elements, stack->next_index);
+            free(stack->elements);
+
+            stack->elements = __simple_stack_inline_elements(stack);
+        }
+
+        stack->length = N;
+        return;
+    }
+
+    E* new_space = NULL;
+
+    if (__simple_stack_is_trivial<E> && !__simple_stack_is_inline(stack))
+        new_space = (E*) realloc((void*) stack->elements, new_length * sizeof(E));
+    else {
+        // Realloc would just copy bytes, elements should be moved instead
+        new_space = (E*) malloc(new_length * sizeof(E));
 
-        assert(new_space != NULL);
+        if (new_space != NULL) {
+            __simple_stack_relocate(new_space, stack->elements, stack->next_index);
 
-        stack->elements = new_space;
+            if (!__simple_stack_is_inline(stack))
+                free((void*) stack->elements);
+        }
     }
 
-    stack->elements[stack->next_index ++] = element;
+    assert(new_space != NULL);
+
+    stack->elements = new_space;
+    stack->length = new_length;
 }
 
-template <typename E>
-E simple_stack_peek(simple_stack<E>* const stack) {
+template <typename E, size_t N>
+void simple_stack_create(simple_stack<E, N>* const stack,
+                         const stack_growth_policy* growth_policy =
+                            &STACK_DEFAULT_GROWTH_POLICY) {
+    stack->next_index = 0;
+    stack->growth_policy = growth_policy;
+
+    if (N > 0) {
+        stack->elements = __simple_stack_inline_elements(stack);
+        stack->length = N;
+        return;
+    }
+
+    stack->length = stack_growth_policy_initial_capacity(growth_policy);
+    stack->elements = (E*) calloc(sizeof(E), stack->length);
+}
+
+/**
+ * Make sure that stack can hold at least capacity
+ * elements without reallocation, never shrinks stack.
+ */
+template <typename E, size_t N>
+void simple_stack_reserve(simple_stack<E, N>* const stack, const size_t capacity) {
+    if (capacity > stack->length)
+        __simple_stack_reallocate(stack, capacity);
+}
+
+// Grow according to policy, until number_of_elements fit
+template <typename E, size_t N>
+inline void __simple_stack_grow_to_fit(simple_stack<E, N>* const stack,
+                                       const size_t number_of_elements) {
+    size_t new_length = stack->length;
+    while (new_length < number_of_elements)
+        new_length = stack_growth_policy_grow(stack->growth_policy, new_length);
+
+    simple_stack_reserve(stack, new_length);
+}
+
+// Shrink as much as policy allows, stack with inline space can shrink back into it
+template <typename E, size_t N>
+inline void __simple_stack_shrink_to_fit(simple_stack<E, N>* const stack) {
+    if (__simple_stack_is_inline(stack))
+        return;
+
+    size_t new_length = stack->length, shrinked_length = 0;
+    while ((shrinked_length = stack_growth_policy_shrink(stack->growth_policy,
+                                stack->next_index, new_length)) < new_length)
+        new_length = shrinked_length;
+
+    if (new_length < stack->length)
+        __simple_stack_reallocate(stack, new_length);
+}
+
+/**
+ * Construct new element from args right on top of the stack.
+ */
+template <typename E, size_t N, typename... Args>
+E* simple_stack_emplace(simple_stack<E, N>* const stack, Args&&... args) {
+    __simple_stack_grow_to_fit(stack, stack->next_index + 1);
+
+    return new (&stack->elements[stack->next_index ++]) E(std::forward<Args>(args)...);
+}
+
+template <typename E, size_t N>
+void simple_stack_push(simple_stack<E, N>* const stack, E element) {
+    simple_stack_emplace(stack, std::move(element));
+}
+
+/**
+ * Copy count elements from range to the top of
+ * the stack, reallocating at most once.
+ */
+template <typename E, size_t N>
+void simple_stack_push_range(simple_stack<E, N>* const stack,
+                             const E* const range, const size_t count) {
+
+    __simple_stack_grow_to_fit(stack, stack->next_index + count);
+
+    E* top = stack->elements + stack->next_index;
+
+    if constexpr (__simple_stack_is_trivial<E>)
+        memcpy((void*) top, (const void*) range, count * sizeof(E));
+    else
+        for (size_t i = 0; i < count; ++ i)
+            new (&top[i]) E(range[i]);
+
+    stack->next_index += count;
+}
+
+template <typename E, size_t N>
+E simple_stack_peek(simple_stack<E, N>* const stack) {
     assert(stack->next_index > 0); // TODO
     return stack->elements[stack->next_index - 1];
 }
 
-template <typename E>
-E simple_stack_pop(simple_stack<E>* const stack) {
-    const size_t shrinked_size = stack->length / grow_coefficient;
+template <typename E, size_t N>
+E simple_stack_pop(simple_stack<E, N>* const stack) {
+    E* top_ptr = &stack->elements[-- stack->next_index];
 
-    if (stack->next_index - 1 < shrinked_size && shrinked_size >= init_nmemb) {
-        stack->length = shrinked_size;
-        E* new_space = (E*) realloc(stack->elements, stack->length * sizeof(E));
+    E top = std::move(*top_ptr);
+    top_ptr->~E();
 
-        assert(new_space != NULL);
+    __simple_stack_shrink_to_fit(stack);
 
-        stack->elements = new_space;
-    }
+    return top;
+}
 
-    return stack->elements[-- stack->next_index];
+/**
+ * Move count elements from the top of the stack to output, they keep
+ * order they had in stack (so output[count - 1] is the former top).
+ * Output should be uninitialized for non trivially copyable elements.
+ */
+template <typename E, size_t N>
+void simple_stack_pop_range(simple_stack<E, N>* const stack,
+                            E* const output, const size_t count) {
+    assert(count <= stack->next_index);
+
+    stack->next_index -= count;
+    __simple_stack_relocate(output, stack->elements + stack->next_index, count);
+
+    __simple_stack_shrink_to_fit(stack);
 }
 
-template <typename E>
-void simple_stack_reverse(simple_stack<E>* const stack) {
+template <typename E, size_t N>
+void simple_stack_reverse(simple_stack<E, N>* const stack) {
     for (int low = 0, high = stack->next_index - 1; low < high; low++, high--) {
-        E temp                = stack->elements[ low];
-        stack->elements[ low] = stack->elements[high];
-        stack->elements[high] = temp;
+        E temp                = std::move(stack->elements[ low]);
+        stack->elements[ low] = std::move(stack->elements[high]);
+        stack->elements[high] = std::move(temp);
     }
 }
 
-template <typename E>
-void simple_stack_destruct(simple_stack<E>* const stack) {
-    free(stack->elements);
+template <typename E, size_t N>
+void simple_stack_destruct(simple_stack<E, N>* const stack) {
+    if constexpr (!__simple_stack_is_trivial<E>)
+        for (size_t i = 0; i < stack->next_index; ++ i)
+            stack->elements[i].~E();
+
+    if (!__simple_stack_is_inline(stack))
+        free((void*) stack->elements);
+
+    stack->elements = NULL;
     stack->length = stack->next_index = 0;
 }
 
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+
+/**
+ * Describes how capacity of a stack changes. Stack shrinks only when it's
+ * occupancy drops well below of what growth leaves behind, so workload that
+ * oscillates around capacity boundary doesn't reallocate on every operation.
+ */
+struct stack_growth_policy {
+    double grow_factor;      //!< Capacity gets multiplied by it, when stack is full
+
+    double shrink_occupancy; //!< Stack shrinks by grow_factor, when
+                             //!< used / capacity drops below it
+
+    size_t min_capacity;     //!< Initial capacity, stack never shrinks below it
+
+    bool never_shrink;       //!< Capacity only grows, memory is
+                             //!< given back only on destruction
+};
+
+const stack_growth_policy STACK_DEFAULT_GROWTH_POLICY = {
+    .grow_factor = 2.0, .shrink_occupancy = 0.25,
+    .min_capacity = 10, .never_shrink = false
+};
+
+const stack_growth_policy STACK_NEVER_SHRINK_GROWTH_POLICY = {
+    .grow_factor = 2.0, .shrink_occupancy = 0.0,
+    .min_capacity = 10, .never_shrink = true
+};
+
+inline size_t stack_growth_policy_initial_capacity(const stack_growth_policy* policy) {
+    return policy->min_capacity > 0 ? policy->min_capacity : 1;
+}
+
+/**
+ * Capacity that full stack of given capacity should grow to.
+ */
+inline size_t stack_growth_policy_grow(const stack_growth_policy* policy,
+                                       const size_t capacity) {
+
+    size_t new_capacity = (size_t) ((double) capacity * policy->grow_factor);
+
+    // Factor could be too small to make any progress
+    if (new_capacity <= capacity)
+        new_capacity = capacity + 1;
+
+    const size_t initial_capacity = stack_growth_policy_initial_capacity(policy);
+    return new_capacity < initial_capacity ? initial_capacity : new_capacity;
+}
+
+/**
+ * Capacity that stack with used elements should shrink
+ * to, it's the same capacity if stack shouldn't shrink.
+ */
+inline size_t stack_growth_policy_shrink(const stack_growth_policy* policy,
+                                         const size_t used, const size_t capacity) {
+
+    if (policy->never_shrink ||
+            (double) used >= (double) capacity * policy->shrink_occupancy)
+        return capacity;
+
+    size_t new_capacity = (size_t) ((double) capacity / policy->grow_factor);
+
+    if (new_capacity < used)
+        new_capacity = used;
+
+    const size_t initial_capacity = stack_growth_policy_initial_capacity(policy);
+    if (new_capacity < initial_capacity)
+        new_capacity = initial_capacity;
+
+    return new_capacity < capacity ? new_capacity : capacity;
+}
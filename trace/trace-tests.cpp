@@ -1,6 +1,8 @@
 #include "trace.h"
 #include "test-framework.h"
 #include <cstdlib>
+#include <cstring>
+#include <pthread.h>
 
 stack_trace* function_that_always_succeeds() {
     return SUCCESS();
@@ -64,6 +66,57 @@ TEST(test_finally) {
 }
 
 
+TEST(test_many_alive_failures) {
+    const int number_of_traces = 1000;
+    stack_trace* traces[number_of_traces] = {};
+
+    // Way more than fits in preallocated space, the rest goes to heap
+    for (int i = 0; i < number_of_traces; ++ i)
+        traces[i] = PASS_FAILURE(i % 2 == 0 ? NULL : traces[i - 1],
+                                 RUNTIME_ERROR, "Failure #%d", i);
+
+    for (int i = 0; i < number_of_traces; ++ i) {
+        char expected[32] = {};
+        snprintf(expected, sizeof(expected), "Failure #%d", i);
+
+        ASSERT_EQUAL(strcmp(traces[i]->latest_error.description, expected) == 0, true);
+    }
+
+    for (int i = 1; i < number_of_traces; i += 2)
+        trace_destruct(traces[i]);
+}
+
+
+TEST(test_long_failure_message) {
+    char long_message[1000] = {};
+    memset(long_message, 'a', sizeof(long_message) - 1);
+
+    stack_trace* trace = FAILURE(RUNTIME_ERROR, "%s!", long_message);
+
+    ASSERT_EQUAL((int) strlen(trace->latest_error.description), (int) sizeof(long_message));
+    trace_destruct(trace);
+}
+
+
+static void* fail_in_thread(void* trace) {
+    *(stack_trace**) trace = FAILURE(RUNTIME_ERROR, "Failed in other thread!");
+    return NULL;
+}
+
+TEST(test_failure_outlives_thread) {
+    stack_trace* trace_from_thread = NULL;
+
+    pthread_t thread = {};
+    pthread_create(&thread, NULL, fail_in_thread, &trace_from_thread);
+    pthread_join(thread, NULL);
+
+    stack_trace* trace = PASS_FAILURE(trace_from_thread, RUNTIME_ERROR, "Caught it!");
+    ASSERT_EQUAL(strcmp(trace->trace->latest_error.description, "Failed in other thread!") == 0, true);
+
+    trace_destruct(trace);
+}
+
+
 int main(void) {
     return test_framework_run_all_unit_tests();
 }  
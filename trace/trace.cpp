@@ -29,29 +29,92 @@ bool trace_is_success(stack_trace* trace) {
 static stack_trace __trace_stack_trace_reserved_space_in_case_calloc_fails;
 static char __trace_error_message_reserved_space_in_case_calloc_fails[256];
 
-stack_trace* __trace_create_failure(stack_trace* cause, int code, occurance occured,
-                                    const char* format, ...) {
+// Failures don't touch heap at all, while thread keeps at most
+// TRACE_RING_SIZE of them alive and their messages are short enough
+static const size_t TRACE_RING_SIZE = 64;
+static const size_t TRACE_MESSAGE_SIZE = 256;
+
+struct __trace_slot {
+    stack_trace trace; // Goes first, so slot can be found by its trace
+    char message[TRACE_MESSAGE_SIZE];
+
+    bool in_use; //!< Cleared by whichever thread destructs trace
+};
+
+// Set in ring's state, after thread that owns ring has exited
+static const size_t TRACE_RING_ORPHANED = (size_t) 1 << (8 * sizeof(size_t) - 1);
+
+struct __trace_ring {
+    __trace_slot slots[TRACE_RING_SIZE];
+    size_t next_slot; //!< Only touched by owner thread
+
+    size_t state; //!< Number of traces in use and #TRACE_RING_ORPHANED bit
+};
+
+/**
+ * Traces can be passed to (and destructed by) other threads, so they can
+ * outlive thread that created them. Orphaned ring is freed by the last
+ * trace returned to it, or right away if no traces are in use.
+ */
+struct __trace_ring_owner {
+    __trace_ring* ring;
+
+    ~__trace_ring_owner() {
+        if (ring != NULL &&
+            __atomic_fetch_or(&ring->state, TRACE_RING_ORPHANED, __ATOMIC_ACQ_REL) == 0)
+            free(ring);
+    }
+};
 
-    if (cause != NULL && trace_is_success(cause))
-        return FAILURE(LOGIC_ERROR, "Error can't be caused by success!");
+static thread_local __trace_ring_owner __trace_thread_ring = {};
 
-    stack_trace* new_trace = (stack_trace*) calloc(1, sizeof(*new_trace));
+// Returns NULL if every slot is in use
+static stack_trace* __trace_ring_take() {
+    __trace_ring* ring = __trace_thread_ring.ring;
 
-    if (new_trace == NULL) {
-        fprintf(stderr, "Lost and unwrapped error: %s\n", format);
-        format = "Trace allocation failed, actual error was lost";
+    // Allocated once per thread, on its first failure
+    if (ring == NULL)
+        ring = __trace_thread_ring.ring = (__trace_ring*) calloc(1, sizeof(*ring));
 
-        // We could be unable to notify user about actual error with
-        // trace mechanism, that's a big problem, let's show message:
-        perror(format);
+    if (ring == NULL)
+        return NULL;
 
-        // calloc failed, but we still need a way to notify user
-        // about error, so we will use static space for that:
-        new_trace = &__trace_stack_trace_reserved_space_in_case_calloc_fails;
+    for (size_t i = 0; i < TRACE_RING_SIZE; ++ i) {
+        __trace_slot* slot = &ring->slots[ring->next_slot];
+        ring->next_slot = (ring->next_slot + 1) % TRACE_RING_SIZE;
+
+        if (__atomic_load_n(&slot->in_use, __ATOMIC_ACQUIRE))
+            continue;
+
+        __atomic_store_n(&slot->in_use, true, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ring->state, 1, __ATOMIC_RELAXED);
+
+        slot->trace.ring = ring;
+        return &slot->trace;
     }
 
-    va_list  vprintf_args;
-    va_start(vprintf_args, format);
+    return NULL;
+}
+
+static void __trace_ring_release(stack_trace* trace) {
+    __trace_ring* ring = trace->ring;
+
+    __atomic_store_n(&((__trace_slot*) trace)->in_use, false, __ATOMIC_RELEASE);
+
+    if (__atomic_fetch_sub(&ring->state, 1, __ATOMIC_ACQ_REL) == (TRACE_RING_ORPHANED | 1))
+        free(ring);
+}
+
+/**
+ * Format message into space (can be NULL if size is 0), in one pass
+ * if it fits. Otherwise message is put on heap or, if that fails,
+ * truncated into reserved static space.
+ */
+static char* __trace_format_message(char* space, size_t size,
+                                    const char* format, va_list vprintf_args) {
+
+    va_list args_copy_for_inline_space;
+    va_copy(args_copy_for_inline_space, vprintf_args);
 
     #pragma clang diagnostic push
 
@@ -59,65 +122,101 @@ stack_trace* __trace_create_failure(stack_trace* cause, int code, occurance occu
     // literals, so disabling warning should be ok:
     #pragma clang diagnostic ignored "-Wformat-nonliteral"
 
-    va_list args_copy_for_size_calculation;
-    va_copy(args_copy_for_size_calculation, vprintf_args);
-
-    // Calculate buffer size first, works since C99 
-    int buffer_size = vsnprintf(NULL, 0, format, args_copy_for_size_calculation) + 1;
+    // Also calculates buffer size, if message doesn't fit, works since C99
+    int message_size = vsnprintf(space, size, format, args_copy_for_inline_space);
     #pragma clang diagnostic pop
 
-    if (buffer_size < 0) {
+    va_end(args_copy_for_inline_space);
+
+    if (message_size < 0) {
         fprintf(stderr, "Lost and unwrapped error: %s\n", format);
 
-        // vsprintf failed, we need to notify user about that:
-        format = "Message size calculation failed, actual error was lost!";
+        // vsnprintf failed, we need to notify user about that:
+        const char* message = "Error message construction failed, actual error was lost!";
 
-        // We could be unable to notify user about actual error with
+        // We are unable to notify our user about actual error with
         // trace mechanism, that's a big problem, let's show message:
-        fprintf(stderr, "%s", format);
+        fprintf(stderr, "%s\n", message);
 
-        // Update buffer size, format is just a string now, so it's size will be just:
-        buffer_size = (int) strlen(format);
+        if (space == NULL) {
+            space = __trace_error_message_reserved_space_in_case_calloc_fails;
+            size = sizeof(__trace_error_message_reserved_space_in_case_calloc_fails);
+        }
+
+        snprintf(space, size, "%s", message);
+        return space;
     }
 
-    char* message_buffer = (char*) calloc((size_t) buffer_size, sizeof(*message_buffer));
+    if ((size_t) message_size < size)
+        return space;
+
+    size_t buffer_size = (size_t) message_size + 1;
+    char* message_buffer = (char*) calloc(buffer_size, sizeof(*message_buffer));
 
     if (message_buffer == NULL) {
         fprintf(stderr, "Lost and unwrapped error: %s\n", format);
-        format = "Trace message allocation failed, actual error was lost";
 
         // We could be unable to notify user about error with
         // trace mechanism, that's a big problem, let's show message:
         perror("Trace message allocation failed, actual error was lost");
 
         message_buffer = __trace_error_message_reserved_space_in_case_calloc_fails;
+        buffer_size = sizeof(__trace_error_message_reserved_space_in_case_calloc_fails);
     }
 
     #pragma clang diagnostic push
-
-    // This function is intended for use only with string
-    // literals, so disabling warning should be ok:
     #pragma clang diagnostic ignored "-Wformat-nonliteral"
-    int written_byte = vsnprintf(message_buffer, (size_t) buffer_size,
-                                 format, vprintf_args);
+    vsnprintf(message_buffer, buffer_size, format, vprintf_args);
     #pragma clang diagnostic pop
 
-    // Final message with const qualifier
-    const char* message = message_buffer;
+    return message_buffer;
+}
+
+stack_trace* __trace_create_failure(stack_trace* cause, int code, occurance occured,
+                                    const char* format, ...) {
+
+    if (cause != NULL && trace_is_success(cause))
+        return FAILURE(LOGIC_ERROR, "Error can't be caused by success!");
+
+    stack_trace* new_trace = __trace_ring_take();
+
+    // Ring is exhausted, too many traces are alive in this thread
+    if (new_trace == NULL)
+        new_trace = (stack_trace*) calloc(1, sizeof(*new_trace));
 
-    if (written_byte < 0) {
+    if (new_trace == NULL) {
         fprintf(stderr, "Lost and unwrapped error: %s\n", format);
-        message = "Error message construction failed, actual error was lost!";
+        format = "Trace allocation failed, actual error was lost";
 
-        // We are unable to notify our user about actual error with
+        // We could be unable to notify user about actual error with
         // trace mechanism, that's a big problem, let's show message:
-        fprintf(stderr, "%s", message);
+        perror(format);
+
+        // calloc failed, but we still need a way to notify user
+        // about error, so we will use static space for that:
+        new_trace = &__trace_stack_trace_reserved_space_in_case_calloc_fails;
+    }
+
+    // Traces from ring have space for message right after them
+    char* message_space = NULL;
+    size_t message_space_size = 0;
+
+    if (new_trace->ring != NULL) {
+        message_space = ((__trace_slot*) new_trace)->message;
+        message_space_size = TRACE_MESSAGE_SIZE;
     }
 
+    va_list  vprintf_args;
+    va_start(vprintf_args, format);
+
+    char* message = __trace_format_message(message_space, message_space_size,
+                                           format, vprintf_args);
+    va_end(vprintf_args);
+
     new_trace->trace = cause;
     new_trace->latest_error = error {
         .error_code = code,
-        .description = message_buffer,
+        .description = message,
         .occured = occured
     };
 
@@ -189,8 +288,19 @@ void trace_destruct(stack_trace* trace) {
 
     trace_destruct(trace->trace);
 
-    free((char*) trace->latest_error.description);
-    free(trace), trace = NULL;
+    char* description = trace->latest_error.description;
+
+    bool is_description_inline = trace->ring != NULL &&
+                                 description == ((__trace_slot*) trace)->message;
+
+    if (!is_description_inline &&
+        description != __trace_error_message_reserved_space_in_case_calloc_fails)
+        free(description);
+
+    if (trace->ring != NULL)
+        __trace_ring_release(trace);
+    else if (trace != &__trace_stack_trace_reserved_space_in_case_calloc_fails)
+        free(trace);
 }
 
 thread_local jmp_buf finally_return_addr = {};
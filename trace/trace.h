@@ -50,6 +50,9 @@ struct error {
     occurance occured;
 };
 
+// Per thread ring of preallocated traces, see trace.cpp
+struct __trace_ring;
+
 /**
  * Represents linked list of errors that caused each
  * other in chronological order.
@@ -59,6 +62,9 @@ struct stack_trace {
 
     stack_trace *trace; //!< Linked list of errors that cause it,
                         //!< #NULL if doesn't have cause
+
+    __trace_ring* ring; //!< Ring this trace was taken from,
+                        //!< #NULL if it's allocated some other way
 };
 
 
@@ -0,0 +1,83 @@
+#include "unrolled-list.h"
+#include "test-framework.h"
+
+#define ASSERT_CONTENT(list, type, ...)                                     \
+    do {                                                                    \
+        type __expected_content[] = { __VA_ARGS__ };                        \
+        ASSERT_EQUAL((int) (list)->used, (int) sizeof(__expected_content) / \
+                     (int) sizeof (*__expected_content));                   \
+                                                                            \
+        int count = 0;                                                      \
+        UNROLLED_LIST_TRAVERSE(list, type, current)                         \
+            ASSERT_EQUAL(__expected_content[count ++], *current);           \
+    } while(false)
+
+
+TEST(populate_unrolled_list_with_lots_of_elements) {
+    unrolled_list<int> list = {};
+    TRY unrolled_list_create(&list)
+        ASSERT_SUCCESS();
+
+    const int num_elements = 50000;
+    for (int i = 0; i < num_elements; ++ i)
+        unrolled_list_push_back(&list, i);
+
+    // Chunks should be fully packed after pushing to back
+    ASSERT_EQUAL((int) list.chunks.used,
+        (num_elements + 63) / 64 /* int fits 64 times in a chunk */);
+
+    int index = 0;
+    UNROLLED_LIST_TRAVERSE(&list, int, current)
+        ASSERT_EQUAL(*current, index ++);
+
+    ASSERT_EQUAL(index, num_elements);
+
+    int value = -1;
+    TRY unrolled_list_get_logical(&list, 12345, &value)
+        ASSERT_SUCCESS();
+    ASSERT_EQUAL(value, 12345);
+
+    unrolled_list_destroy(&list);
+}
+
+TEST(split_and_merge_unrolled_list_chunks) {
+    unrolled_list<int, 8> list = {};
+    TRY unrolled_list_create(&list)
+        ASSERT_SUCCESS();
+
+    unrolled_list_position first = {};
+    unrolled_list_push_back(&list, 0, &first);
+
+    for (int i = 1; i < 8; ++ i)
+        unrolled_list_push_back(&list, i * 10);
+
+    // Chunk is full, so this splits it in half
+    TRY unrolled_list_insert_after(&list, 5, first)
+        ASSERT_SUCCESS();
+
+    ASSERT_EQUAL((int) list.chunks.used, 2);
+    ASSERT_CONTENT(&list, int, 0, 5, 10, 20, 30, 40, 50, 60, 70);
+
+    unrolled_list_push_front(&list, -1);
+    ASSERT_CONTENT(&list, int, -1, 0, 5, 10, 20, 30, 40, 50, 60, 70);
+
+    // Deleting from first chunk makes it small enough to merge second one
+    for (int i = 0; i < 3; ++ i)
+        TRY unrolled_list_pop_front(&list)
+            ASSERT_SUCCESS();
+
+    ASSERT_EQUAL((int) list.chunks.used, 1);
+    ASSERT_CONTENT(&list, int, 10, 20, 30, 40, 50, 60, 70);
+
+    unrolled_list_pop_back(&list);
+    ASSERT_CONTENT(&list, int, 10, 20, 30, 40, 50, 60);
+
+    while (list.used > 0)
+        unrolled_list_pop_back(&list);
+
+    ASSERT_EQUAL((int) list.chunks.used, 0);
+
+    unrolled_list_destroy(&list);
+}
+
+TEST_MAIN()
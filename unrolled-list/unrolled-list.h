@@ -0,0 +1,308 @@
+#pragma once
+
+#include "linked-list.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+
+/**
+ * Default number of elements in a chunk, chunk should span a few cache
+ * lines, but not less than 8 and not more than 64 elements.
+ */
+template <typename E>
+constexpr size_t unrolled_list_default_chunk_capacity() {
+    const size_t target_chunk_size = 256; // In bytes
+
+    const size_t capacity = target_chunk_size / sizeof(E);
+    return capacity < 8 ? 8 : capacity > 64 ? 64 : capacity;
+}
+
+template <typename E, size_t N>
+struct unrolled_list_chunk {
+    size_t count;
+    E elements[N];
+};
+
+/**
+ * Doubly linked list of chunks each holding up to N elements, so
+ * traversal is mostly sequential in memory even when list is fragmented.
+ * Chunks themselves live in #linked_list, so they're allocated in bulk.
+ */
+template <typename E, size_t N = unrolled_list_default_chunk_capacity<E>()>
+struct unrolled_list {
+    static_assert(std::is_trivially_copyable_v<E>,
+                  "Elements are moved between and within chunks bytewise!");
+
+    linked_list<unrolled_list_chunk<E, N>> chunks;
+    size_t used;
+};
+
+/**
+ * Place of element in an unrolled list, unlike #element_index_t
+ * it gets invalidated by insertion or deletion in the same chunk.
+ */
+struct unrolled_list_position {
+    element_index_t chunk;
+    size_t offset;
+};
+
+
+template <typename E, size_t N>
+inline unrolled_list_chunk<E, N>* unrolled_list_get_chunk(unrolled_list<E, N>* list,
+                                                          element_index_t chunk_index) {
+    return &linked_list_get_pointer(&list->chunks, chunk_index)->element;
+}
+
+template <typename E, size_t N>
+inline E* unrolled_list_get_pointer(unrolled_list<E, N>* list,
+                                    unrolled_list_position position) {
+    return &unrolled_list_get_chunk(list, position.chunk)->elements[position.offset];
+}
+
+
+template <typename E, size_t N>
+stack_trace* unrolled_list_create(unrolled_list<E, N>* list, const size_t chunks_capacity = 4) {
+    list->used = 0;
+
+    TRY linked_list_create(&list->chunks, chunks_capacity)
+        FAIL("Failed to create list of %d chunks!", chunks_capacity);
+
+    return SUCCESS();
+}
+
+template <typename E, size_t N>
+void unrolled_list_destroy(unrolled_list<E, N>* list) {
+    if (list != NULL) {
+        linked_list_destroy(&list->chunks);
+        list->used = 0;
+    }
+
+    // Do nothing if list is NULL (like free)
+}
+
+
+template <typename E, size_t N>
+static inline
+stack_trace* __unrolled_list_check_position(unrolled_list<E, N>* list,
+                                            unrolled_list_position position) {
+
+    TRY check_index(&list->chunks, position.chunk) FAIL("Illegal chunk index!");
+
+    if (position.chunk == linked_list_end_index ||
+            is_free_element(&list->chunks, position.chunk))
+        return FAILURE(RUNTIME_ERROR, "Chunk %d isn't in use!", position.chunk);
+
+    const size_t count = unrolled_list_get_chunk(list, position.chunk)->count;
+    if (position.offset >= count)
+        return FAILURE(RUNTIME_ERROR, "Offset %zu overflows chunk %d of size %zu!",
+                       position.offset, position.chunk, count);
+
+    return SUCCESS();
+}
+
+template <typename E, size_t N>
+static inline
+stack_trace* __unrolled_list_add_chunk_after(unrolled_list<E, N>* list,
+                                             element_index_t prev_chunk,
+                                             element_index_t* new_chunk) {
+
+    // Note: this can move chunks, so pointers to them get invalidated
+    TRY linked_list_insert_after(&list->chunks, (unrolled_list_chunk<E, N>) {},
+                                 prev_chunk, new_chunk)
+        FAIL("Failed to allocate new chunk after %d!", prev_chunk);
+
+    return SUCCESS();
+}
+
+/**
+ * Put value at offset in chunk, moving the rest of it one step further,
+ * full chunk gets split in half to make space.
+ */
+template <typename E, size_t N>
+static inline
+stack_trace* __unrolled_list_insert_at(unrolled_list<E, N>* list, E value,
+                                       element_index_t chunk_index, size_t offset,
+                                       unrolled_list_position* actual_position) {
+
+    if (unrolled_list_get_chunk(list, chunk_index)->count == N) {
+        element_index_t upper_index = -1;
+        TRY __unrolled_list_add_chunk_after(list, chunk_index, &upper_index)
+            FAIL("Failed to split chunk %d!", chunk_index);
+
+        unrolled_list_chunk<E, N> *lower = unrolled_list_get_chunk(list, chunk_index),
+                                  *upper = unrolled_list_get_chunk(list, upper_index);
+
+        //    +-------------+        +-------+   +-------+
+        //    | LOWER UPPER |  =>    | LOWER |   | UPPER |
+        //    +-------------+        +-------+   +-------+
+
+        const size_t half = N / 2;
+        memcpy(upper->elements, lower->elements + half, (N - half) * sizeof(E));
+
+        upper->count = N - half;
+        lower->count = half;
+
+        if (offset > half) {
+            chunk_index = upper_index;
+            offset -= half;
+        }
+    }
+
+    unrolled_list_chunk<E, N>* chunk = unrolled_list_get_chunk(list, chunk_index);
+
+    memmove(chunk->elements + offset + 1, chunk->elements + offset,
+            (chunk->count - offset) * sizeof(E));
+
+    chunk->elements[offset] = value;
+
+    ++ chunk->count;
+    ++ list->used;
+
+    if (actual_position != NULL)
+        *actual_position = { chunk_index, offset };
+
+    return SUCCESS();
+}
+
+template <typename E, size_t N>
+stack_trace* unrolled_list_insert_after(unrolled_list<E, N>* list, E value,
+                                        unrolled_list_position prev_position,
+                                        unrolled_list_position* actual_position = NULL) {
+
+    TRY __unrolled_list_check_position(list, prev_position)
+        FAIL("Illegal position passed!");
+
+    return __unrolled_list_insert_at(list, value, prev_position.chunk,
+                                     prev_position.offset + 1, actual_position);
+}
+
+template <typename E, size_t N>
+stack_trace* unrolled_list_push_back(unrolled_list<E, N>* list, E value,
+                                     unrolled_list_position* actual_position = NULL) {
+
+    element_index_t tail = linked_list_tail_index(&list->chunks);
+
+    // Don't split full tail, start a new chunk, so it ends up fully packed
+    if (tail == linked_list_end_index || unrolled_list_get_chunk(list, tail)->count == N)
+        TRY __unrolled_list_add_chunk_after(list, tail, &tail)
+            FAIL("Failed to add chunk to the back!");
+
+    return __unrolled_list_insert_at(list, value, tail,
+        unrolled_list_get_chunk(list, tail)->count, actual_position);
+}
+
+template <typename E, size_t N>
+stack_trace* unrolled_list_push_front(unrolled_list<E, N>* list, E value,
+                                      unrolled_list_position* actual_position = NULL) {
+
+    element_index_t head = linked_list_head_index(&list->chunks);
+
+    if (head == linked_list_end_index || unrolled_list_get_chunk(list, head)->count == N)
+        TRY __unrolled_list_add_chunk_after(list, linked_list_end_index, &head)
+            FAIL("Failed to add chunk to the front!");
+
+    return __unrolled_list_insert_at(list, value, head, 0, actual_position);
+}
+
+
+template <typename E, size_t N>
+stack_trace* unrolled_list_delete(unrolled_list<E, N>* list,
+                                  unrolled_list_position position) {
+
+    TRY __unrolled_list_check_position(list, position)
+        FAIL("Illegal position passed!");
+
+    unrolled_list_chunk<E, N>* chunk = unrolled_list_get_chunk(list, position.chunk);
+
+    -- chunk->count;
+    -- list->used;
+
+    memmove(chunk->elements + position.offset, chunk->elements + position.offset + 1,
+            (chunk->count - position.offset) * sizeof(E));
+
+    if (chunk->count == 0) {
+        TRY linked_list_delete(&list->chunks, position.chunk)
+            FAIL("Failed to delete empty chunk %d!", position.chunk);
+
+        return SUCCESS();
+    }
+
+    const element_index_t next_index =
+        linked_list_get_pointer(&list->chunks, position.chunk)->next_index;
+
+    if (chunk->count >= N / 2 || next_index == linked_list_end_index)
+        return SUCCESS();
+
+    // Chunk is less than half full, merge next one in, if it fits
+    unrolled_list_chunk<E, N>* next = unrolled_list_get_chunk(list, next_index);
+
+    if (chunk->count + next->count > N)
+        return SUCCESS();
+
+    memcpy(chunk->elements + chunk->count, next->elements, next->count * sizeof(E));
+    chunk->count += next->count;
+
+    TRY linked_list_delete(&list->chunks, next_index)
+        FAIL("Failed to delete merged chunk %d!", next_index);
+
+    return SUCCESS();
+}
+
+template <typename E, size_t N>
+stack_trace* unrolled_list_pop_front(unrolled_list<E, N>* list) {
+    return unrolled_list_delete(list, { linked_list_head_index(&list->chunks), 0 });
+}
+
+template <typename E, size_t N>
+stack_trace* unrolled_list_pop_back(unrolled_list<E, N>* list) {
+    const element_index_t tail = linked_list_tail_index(&list->chunks);
+
+    if (tail == linked_list_end_index)
+        return FAILURE(RUNTIME_ERROR, "Can't pop from empty list!");
+
+    return unrolled_list_delete(list,
+        { tail, unrolled_list_get_chunk(list, tail)->count - 1 });
+}
+
+
+template <typename E, size_t N>
+stack_trace* unrolled_list_get_logical_position(unrolled_list<E, N>* list,
+                                                size_t logical_index,
+                                                unrolled_list_position* position) {
+
+    // Whole chunks can be skipped, so it's N times faster than for linked_list
+    LINKED_LIST_TRAVERSE(&list->chunks, __typeof__(list->chunks.elements->element), current) {
+        if (logical_index < current->element.count) {
+            *position = { linked_list_get_index(&list->chunks, current), logical_index };
+            return SUCCESS();
+        }
+
+        logical_index -= current->element.count;
+    }
+
+    return FAILURE(RUNTIME_ERROR, "Logical index overflows list size %zu!", list->used);
+}
+
+template <typename E, size_t N>
+stack_trace* unrolled_list_get_logical(unrolled_list<E, N>* list,
+                                       size_t logical_index, E* const value) {
+
+    unrolled_list_position position = {};
+    TRY unrolled_list_get_logical_position(list, logical_index, &position)
+        FAIL("Can't find element with logical index %zu!", logical_index);
+
+    *value = *unrolled_list_get_pointer(list, position);
+
+    return SUCCESS();
+}
+
+
+// Note: break inside of traversal body only skips the rest of current chunk
+#define UNROLLED_LIST_TRAVERSE(list, type, current)                                 \
+    LINKED_LIST_TRAVERSE(&(list)->chunks,                                           \
+                         __typeof__((list)->chunks.elements->element), __chunk)     \
+        for (type* current = __chunk->element.elements;                            \
+                current < __chunk->element.elements + __chunk->element.count;      \
+                ++ current)